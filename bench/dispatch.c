@@ -0,0 +1,332 @@
+// Dispatch cost of the computed-goto interpreter against the tail-calling
+// one, on the same module in the same binary.
+//
+// Runs a recursive fib(n), which is almost only loads, integer arithmetic,
+// comparisons, calls and returns, through run_interpreter_loop and
+// run_interpreter_tail in turn, after the same verification, integer
+// specialization and superinstruction fusion as main.c. Both run with the
+// JIT disabled, then the goto loop once more with register code (when built
+// with REGISTER_TIER=1), and once with the JIT enabled (when built with
+// JIT=1).
+//
+// Then tests -1 < 0 a few thousand times through the fused, unfused and
+// compiled forms of IJumpElseRelCmpConst, which must all branch the same way,
+// and `and` and `or` through IJumpElseRelCmp. Last, switches on a dense and
+// a sparse table of integers, which compiled code jumps through differently.
+//
+// Usage: plume-dispatch-bench [n] [runs]
+
+#include <bytecode.h>
+#include <inference.h>
+#include <interpreter.h>
+#include <jit.h>
+#include <module.h>
+#include <registers.h>
+#include <superinstructions.h>
+#include <switches.h>
+#include <verifier.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define FIB 0
+#define RESULT 1
+#define BELOW 2
+#define SIGNS 3
+#define I 4
+#define NEGATIVE 5
+#define MASKED 6
+#define MASKS 7
+#define DENSE 8
+#define SPARSE 9
+#define ARMS 10
+
+// Above jit_threshold, so that below(x), masked(x) and the switches are
+// compiled
+#define CALLS 2000
+
+// Constants of the program
+enum {
+  C_ONE, C_TWO, C_N, C_ZERO, C_FOUR, C_MINUS_ONE, C_CALLS, C_EIGHT, C_SIXTEEN, C_THIRTY_TWO, C_SIXTY_FOUR,
+  C_DENSE_TABLE, C_SPARSE_TABLE = C_DENSE_TABLE + 9, C_CONSTANTS = C_SPARSE_TABLE + 7 };
+
+// Each arm of the switches, and only one, is taken once for i < CALLS
+#define ALL_ARMS 127
+
+static const int32_t program[][4] = {
+  // fib(n), one argument and no other local, at -1 from the base pointer
+  /*   0 */ { OP_MakeAndStoreLambda, FIB, 12, 1 },
+  /*   1 */ { OP_LoadLocal, -1, 0, 0 },
+  /*   2 */ { OP_IJumpElseRelCmpConst, 3, LessThan, C_TWO },
+  /*   3 */ { OP_LoadLocal, -1, 0, 0 },
+  /*   4 */ { OP_Return, 0, 0, 0 },
+  /*   5 */ { OP_LoadLocal, -1, 0, 0 },
+  /*   6 */ { OP_SubConst, C_ONE, 0, 0 },
+  /*   7 */ { OP_CallGlobal, FIB, 1, 0 },
+  /*   8 */ { OP_LoadLocal, -1, 0, 0 },
+  /*   9 */ { OP_SubConst, C_TWO, 0, 0 },
+  /*  10 */ { OP_CallGlobal, FIB, 1, 0 },
+  /*  11 */ { OP_Add, 0, 0, 0 },
+  /*  12 */ { OP_Return, 0, 0, 0 },
+
+  // below(x), 1 if x < 0 and 0 otherwise
+  /*  13 */ { OP_MakeAndStoreLambda, BELOW, 6, 1 },
+  /*  14 */ { OP_LoadLocal, -1, 0, 0 },
+  /*  15 */ { OP_IJumpElseRelCmpConst, 3, LessThan, C_ZERO },
+  /*  16 */ { OP_LoadConstant, C_ONE, 0, 0 },
+  /*  17 */ { OP_Return, 0, 0, 0 },
+  /*  18 */ { OP_LoadConstant, C_ZERO, 0, 0 },
+  /*  19 */ { OP_Return, 0, 0, 0 },
+
+  // masked(x), 1 if x & 2, else 2 if x | 0, else 0
+  /*  20 */ { OP_MakeAndStoreLambda, MASKED, 12, 1 },
+  /*  21 */ { OP_LoadLocal, -1, 0, 0 },
+  /*  22 */ { OP_LoadConstant, C_TWO, 0, 0 },
+  /*  23 */ { OP_IJumpElseRelCmp, 5, 3, 0 },
+  /*  24 */ { OP_LoadConstant, C_ONE, 0, 0 },
+  /*  25 */ { OP_Return, 0, 0, 0 },
+  /*  26 */ { OP_LoadLocal, -1, 0, 0 },
+  /*  27 */ { OP_LoadConstant, C_ZERO, 0, 0 },
+  /*  28 */ { OP_IJumpElseRelCmp, 6, 3, 0 },
+  /*  29 */ { OP_LoadConstant, C_TWO, 0, 0 },
+  /*  30 */ { OP_Return, 0, 0, 0 },
+  /*  31 */ { OP_LoadConstant, C_ZERO, 0, 0 },
+  /*  32 */ { OP_Return, 0, 0, 0 },
+
+  // dense(x), a switch on 1, 2, 3 and 5 returning 1, 2, 4 and 8, else 0
+  /*  33 */ { OP_MakeAndStoreLambda, DENSE, 12, 1 },
+  /*  34 */ { OP_LoadLocal, -1, 0, 0 },
+  /*  35 */ { OP_Switch, C_DENSE_TABLE, 9, 0 },
+  /*  36 */ { OP_LoadConstant, C_ONE, 0, 0 },
+  /*  37 */ { OP_Return, 0, 0, 0 },
+  /*  38 */ { OP_LoadConstant, C_TWO, 0, 0 },
+  /*  39 */ { OP_Return, 0, 0, 0 },
+  /*  40 */ { OP_LoadConstant, C_FOUR, 0, 0 },
+  /*  41 */ { OP_Return, 0, 0, 0 },
+  /*  42 */ { OP_LoadConstant, C_EIGHT, 0, 0 },
+  /*  43 */ { OP_Return, 0, 0, 0 },
+  /*  44 */ { OP_LoadConstant, C_ZERO, 0, 0 },
+  /*  45 */ { OP_Return, 0, 0, 0 },
+
+  // sparse(x), a switch on 3, 700 and 1500 returning 16, 32 and 64, else 0
+  /*  46 */ { OP_MakeAndStoreLambda, SPARSE, 10, 1 },
+  /*  47 */ { OP_LoadLocal, -1, 0, 0 },
+  /*  48 */ { OP_Switch, C_SPARSE_TABLE, 7, 0 },
+  /*  49 */ { OP_LoadConstant, C_SIXTEEN, 0, 0 },
+  /*  50 */ { OP_Return, 0, 0, 0 },
+  /*  51 */ { OP_LoadConstant, C_THIRTY_TWO, 0, 0 },
+  /*  52 */ { OP_Return, 0, 0, 0 },
+  /*  53 */ { OP_LoadConstant, C_SIXTY_FOUR, 0, 0 },
+  /*  54 */ { OP_Return, 0, 0, 0 },
+  /*  55 */ { OP_LoadConstant, C_ZERO, 0, 0 },
+  /*  56 */ { OP_Return, 0, 0, 0 },
+
+  /*  57 */ { OP_LoadConstant, C_N, 0, 0 },
+  /*  58 */ { OP_CallGlobal, FIB, 1, 0 },
+  /*  59 */ { OP_StoreGlobal, RESULT, 0, 0 },
+
+  // Adds 1, 2 and 4 to SIGNS for each form that finds -1 < 0, masked(i)
+  // to MASKS, and dense(i) + sparse(i) to ARMS
+  /*  60 */ { OP_LoadConstant, C_ZERO, 0, 0 },
+  /*  61 */ { OP_StoreGlobal, SIGNS, 0, 0 },
+  /*  62 */ { OP_LoadConstant, C_ZERO, 0, 0 },
+  /*  63 */ { OP_StoreGlobal, MASKS, 0, 0 },
+  /*  64 */ { OP_LoadConstant, C_ZERO, 0, 0 },
+  /*  65 */ { OP_StoreGlobal, ARMS, 0, 0 },
+  /*  66 */ { OP_LoadConstant, C_ZERO, 0, 0 },
+  /*  67 */ { OP_StoreGlobal, I, 0, 0 },
+  /*  68 */ { OP_LoadConstant, C_MINUS_ONE, 0, 0 },
+  /*  69 */ { OP_StoreGlobal, NEGATIVE, 0, 0 },
+  /*  70 */ { OP_LoadGlobal, I, 0, 0 },
+  /*  71 */ { OP_IJumpElseRelCmpConst, 33, LessThan, C_CALLS },
+  /*  72 */ { OP_LoadConstant, C_MINUS_ONE, 0, 0 },
+  /*  73 */ { OP_CallGlobal, BELOW, 1, 0 },
+  /*  74 */ { OP_LoadGlobal, SIGNS, 0, 0 },
+  /*  75 */ { OP_Add, 0, 0, 0 },
+  /*  76 */ { OP_StoreGlobal, SIGNS, 0, 0 },
+  /*  77 */ { OP_LoadGlobal, NEGATIVE, 0, 0 },
+  /*  78 */ { OP_IJumpElseRelCmpConst, 4, LessThan, C_ZERO },
+  /*  79 */ { OP_LoadGlobal, SIGNS, 0, 0 },
+  /*  80 */ { OP_AddConst, C_TWO, 0, 0 },
+  /*  81 */ { OP_StoreGlobal, SIGNS, 0, 0 },
+  /*  82 */ { OP_LoadConstant, C_MINUS_ONE, 0, 0 },
+  /*  83 */ { OP_IJumpElseRelCmpConst, 4, LessThan, C_ZERO },
+  /*  84 */ { OP_LoadGlobal, SIGNS, 0, 0 },
+  /*  85 */ { OP_AddConst, C_FOUR, 0, 0 },
+  /*  86 */ { OP_StoreGlobal, SIGNS, 0, 0 },
+  /*  87 */ { OP_LoadGlobal, I, 0, 0 },
+  /*  88 */ { OP_CallGlobal, MASKED, 1, 0 },
+  /*  89 */ { OP_LoadGlobal, MASKS, 0, 0 },
+  /*  90 */ { OP_Add, 0, 0, 0 },
+  /*  91 */ { OP_StoreGlobal, MASKS, 0, 0 },
+  /*  92 */ { OP_LoadGlobal, I, 0, 0 },
+  /*  93 */ { OP_CallGlobal, DENSE, 1, 0 },
+  /*  94 */ { OP_LoadGlobal, I, 0, 0 },
+  /*  95 */ { OP_CallGlobal, SPARSE, 1, 0 },
+  /*  96 */ { OP_Add, 0, 0, 0 },
+  /*  97 */ { OP_LoadGlobal, ARMS, 0, 0 },
+  /*  98 */ { OP_Add, 0, 0, 0 },
+  /*  99 */ { OP_StoreGlobal, ARMS, 0, 0 },
+  /* 100 */ { OP_LoadGlobal, I, 0, 0 },
+  /* 101 */ { OP_AddConst, C_ONE, 0, 0 },
+  /* 102 */ { OP_StoreGlobal, I, 0, 0 },
+  /* 103 */ { OP_JumpRel, -33, 0, 0 },
+  /* 104 */ { OP_Halt, 0, 0, 0 },
+};
+
+#define INSTR_COUNT ((int32_t) (sizeof(program) / sizeof(*program)))
+
+typedef Value (*Interpreter)(Deserialized *module, int32_t ipc, bool does_return, int32_t current_callstack);
+
+static int compare_ns(const void* a, const void* b) {
+  uint64_t x = *(const uint64_t*) a, y = *(const uint64_t*) b;
+  return (x > y) - (x < y);
+}
+
+// Whether every form of the comparison took the same branch, all 7 or none
+// of them
+static bool consistent(int32_t signs) {
+  return signs == 0 || signs == 7 * CALLS;
+}
+
+// Globals the program leaves, which every way of running it must agree on
+typedef struct {
+  int32_t result, signs, masks, arms;
+} Outcome;
+
+static bool agree(const char* who, Outcome a, Outcome b, int32_t n) {
+  if (a.result != b.result) {
+    fprintf(stderr, "%s disagree on fib(%d): %d and %d\n", who, n, a.result, b.result);
+  } else if (a.signs != b.signs) {
+    fprintf(stderr, "%s disagree on -1 < 0: %d and %d\n", who, a.signs, b.signs);
+  } else if (a.masks != b.masks) {
+    fprintf(stderr, "%s disagree on x & 2 and x | 0: %d and %d\n", who, a.masks, b.masks);
+  } else if (a.arms != b.arms) {
+    fprintf(stderr, "%s disagree on the arms of switches: %d and %d\n", who, a.arms, b.arms);
+  } else {
+    return true;
+  }
+  return false;
+}
+
+static double bench(Deserialized* module, Interpreter interpreter, size_t runs, uint64_t* samples, Outcome* outcome) {
+  for (size_t r = 0; r < runs; r++) {
+    halt = 0;
+    module->pc = 0;
+    module->callstack = 0;
+    module->base_pointer = 0;
+    module->stack->stack_pointer = BASE_POINTER;
+
+    uint64_t start = gc_clock_ns();
+    interpreter(module, 0, false, 0);
+    samples[r] = gc_clock_ns() - start;
+  }
+  Value* globals = module->stack->values;
+  *outcome = (Outcome) {
+    GET_INT(globals[RESULT]), GET_INT(globals[SIGNS]), GET_INT(globals[MASKS]), GET_INT(globals[ARMS]) };
+  qsort(samples, runs, sizeof(uint64_t), compare_ns);
+  return samples[runs / 2] / 1e6;
+}
+
+int main(int argc, char** argv) {
+  int32_t n = argc > 1 ? (int32_t) strtol(argv[1], NULL, 10) : 30;
+  size_t runs = argc > 2 ? strtoul(argv[2], NULL, 10) : 7;
+
+  gc_start(&gc, &argc);
+  gc_set_tracer(&gc, gc_trace_heap_value);
+
+  Value constants[C_CONSTANTS] = {
+    MAKE_INTEGER(1), MAKE_INTEGER(2), MAKE_INTEGER(n), MAKE_INTEGER(0),
+    MAKE_INTEGER(4), MAKE_INTEGER(-1), MAKE_INTEGER(CALLS), MAKE_INTEGER(8),
+    MAKE_INTEGER(16), MAKE_INTEGER(32), MAKE_INTEGER(64) };
+
+  // Arm count, then keys and jump offsets from the Switch
+  static const int32_t dense[] = { 4, 1, 1, 2, 3, 3, 5, 5, 7 };
+  static const int32_t sparse[] = { 3, 3, 1, 700, 3, 1500, 5 };
+  for (int32_t k = 0; k < 9; k++) constants[C_DENSE_TABLE + k] = MAKE_INTEGER(dense[k]);
+  for (int32_t k = 0; k < 7; k++) constants[C_SPARSE_TABLE + k] = MAKE_INTEGER(sparse[k]);
+
+  int32_t* instrs = gc_malloc(&gc, sizeof(program));
+  memcpy(instrs, program, sizeof(program));
+
+  Deserialized module = { 0 };
+  module.instr_count = INSTR_COUNT;
+  module.instrs = instrs;
+  module.constant_count = sizeof(constants) / sizeof(*constants);
+  module.constants = constants;
+  module.gc = gc;
+  build_switches(&module);
+  module.verified = verify_module(&module);
+  if (module.verified) specialize_integers(&module);
+#if REGISTER_TIER
+  if (module.verified) translate_registers(&module);
+  Registers* registers = module.registers;
+  module.registers = NULL;
+#endif
+  fuse_superinstructions(instrs, INSTR_COUNT);
+  module.stack = stack_new(gc);
+  module.call_function = call_function;
+  module.call_threaded = call_threaded;
+  gc_add_root(&gc, module_mark_roots, &module);
+
+  uint64_t* samples = malloc(runs * sizeof(uint64_t));
+  Outcome loop_outcome, tail_outcome;
+#if JIT
+  uint32_t threshold = jit_threshold;
+  jit_threshold = 0;
+#endif
+  double loop = bench(&module, run_interpreter_loop, runs, samples, &loop_outcome);
+  double tail = bench(&module, run_interpreter_tail, runs, samples, &tail_outcome);
+
+  if (!agree("Interpreters", loop_outcome, tail_outcome, n)) return 1;
+
+  if (!consistent(loop_outcome.signs)) {
+    fprintf(stderr, "Forms of IJumpElseRelCmpConst disagree on -1 < 0: %d\n", loop_outcome.signs);
+    return 1;
+  }
+
+  if (loop_outcome.arms != ALL_ARMS) {
+    fprintf(stderr, "Switches took the wrong arms: %d\n", loop_outcome.arms);
+    return 1;
+  }
+
+#if REGISTER_TIER
+  module.registers = registers;
+
+  Outcome registers_outcome;
+  double regs = bench(&module, run_interpreter_loop, runs, samples, &registers_outcome);
+  module.registers = NULL;
+
+  if (!agree("Register code and the interpreter", registers_outcome, loop_outcome, n)) return 1;
+#endif
+
+#if JIT
+  // Counting starts over
+  jit_threshold = threshold;
+  jit_free(&module);
+
+  Outcome jit_outcome;
+  double jit = bench(&module, run_interpreter_loop, runs, samples, &jit_outcome);
+
+  if (!agree("Compiled code and the interpreter", jit_outcome, loop_outcome, n)) return 1;
+#endif
+
+  printf("fib(%d) = %d, median of %zu runs, %s module\n", n, loop_outcome.result, runs,
+         module.verified ? "verified" : "unverified");
+  printf("%12s %12s %10s\n", "interpreter", "time (ms)", "speedup");
+  printf("%12s %12.3f %9.2fx\n", "goto", loop, 1.0);
+  printf("%12s %12.3f %9.2fx\n", "tail", tail, loop / tail);
+#if REGISTER_TIER
+  printf("%12s %12.3f %9.2fx\n", "goto+regs", regs, loop / regs);
+#endif
+#if JIT
+  printf("%12s %12.3f %9.2fx\n", "goto+jit", jit, loop / jit);
+#endif
+
+#if JIT
+  jit_free(&module);
+#endif
+  free(samples);
+  gc_remove_root(&gc, module_mark_roots, &module);
+  gc_stop(&gc);
+  return 0;
+}
@@ -0,0 +1,79 @@
+// Marking throughput of the collector for a growing number of marker threads.
+//
+// Builds a wide heap: `width` independent lists of `depth` cells, each cell
+// holding a short string, an integer and the rest of its list. The lists are
+// rooted from a precise root scanner, as the VM stack would be. Then times
+// full stop-the-world marks with 1, 2, 4, ... marker threads.
+//
+// Usage: plume-gc-bench [width] [depth] [max threads] [runs]
+
+#include <value.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static Value* lists;
+static size_t list_count;
+
+static void bench_mark_roots(GarbageCollector* gc, void* ctx) {
+  (void) ctx;
+  gc_mark_values(gc, lists, list_count);
+}
+
+static Value build_list(size_t depth) {
+  Value list = MAKE_LIST(gc, &list, 0);
+  for (size_t i = 0; i < depth; i++) {
+    Value cell[3] = { MAKE_STRING(gc, "cell"), MAKE_INTEGER(i), list };
+    list = MAKE_LIST(gc, cell, 3);
+  }
+  return list;
+}
+
+static int compare_ns(const void* a, const void* b) {
+  uint64_t x = *(const uint64_t*) a, y = *(const uint64_t*) b;
+  return (x > y) - (x < y);
+}
+
+int main(int argc, char** argv) {
+  size_t width = argc > 1 ? strtoul(argv[1], NULL, 10) : 4096;
+  size_t depth = argc > 2 ? strtoul(argv[2], NULL, 10) : 256;
+  size_t max_threads = argc > 3 ? strtoul(argv[3], NULL, 10) : gc_cpu_count();
+  size_t runs = argc > 4 ? strtoul(argv[4], NULL, 10) : 5;
+
+  gc_start(&gc, &argc);
+  gc_set_tracer(&gc, gc_trace_heap_value);
+  gc_pause(&gc);
+
+  list_count = width;
+  lists = calloc(width, sizeof(Value));
+  gc_add_root(&gc, bench_mark_roots, NULL);
+  for (size_t i = 0; i < width; i++) lists[i] = build_list(depth);
+
+  printf("heap: %zu lists x %zu cells, %zu objects\n", width, depth, gc_live_objects(&gc));
+  printf("%8s %12s %10s\n", "threads", "mark (ms)", "speedup");
+
+  uint64_t* samples = malloc(runs * sizeof(uint64_t));
+  double serial = 0;
+  for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+    gc_set_mark_threads(&gc, threads);
+    // The collector caps the number of markers at the number of CPUs.
+    if (threads > 1 && (gc.marking->pool == NULL || gc.marking->pool->size < threads)) break;
+    for (size_t r = 0; r < runs; r++) {
+      // Leave no sweeping to the next mark, only marking is measured.
+      gc_slab_sweep_pending(gc.slabs);
+      uint64_t start = gc_clock_ns();
+      gc_mark(&gc);
+      samples[r] = gc_clock_ns() - start;
+      gc_sweep(&gc);
+    }
+    qsort(samples, runs, sizeof(uint64_t), compare_ns);
+    double median = samples[runs / 2] / 1e6;
+    if (threads == 1) serial = median;
+    printf("%8zu %12.3f %9.2fx\n", threads, median, serial / median);
+  }
+
+  free(samples);
+  gc_remove_root(&gc, bench_mark_roots, NULL);
+  free(lists);
+  gc_stop(&gc);
+  return 0;
+}
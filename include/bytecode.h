@@ -43,8 +43,45 @@ typedef enum {
   OP_JumpElseRelCmpConst,
   OP_IJumpElseRelCmpConst,
   OP_CallGlobal,
-  OP_CallNative,
+  OP_CallLocal,
   OP_MakeAndStoreLambda,
+  OP_Mul,
+  OP_MulConst,
+  OP_ReturnUnit,
+  OP_Switch,  // see switches.h
+
+  // Integer variants, only produced by `specialize_integers` in verified
+  // modules, where the operands they would check are proven to be integers.
+  OP_AddInt,
+  OP_SubInt,
+  OP_MulInt,
+  OP_AddConstInt,
+  OP_SubConstInt,
+  OP_MulConstInt,
+  OP_IJumpElseRelCmpConstInt,
+
+  // Superinstructions, only produced by `fuse_superinstructions`. Each one
+  // replaces the opcode of the first instruction of a sequence and reads the
+  // operands of the following ones, which are left in place.
+  OP_LoadLocalLoadLocalAdd,
+  OP_LoadLocalSubConst,
+  OP_LoadLocalReturn,
+  OP_LoadLocalIJumpElseRelCmpConst,
+  OP_LoadLocalCallGlobal,
+  OP_LoadGlobalListGet,
+  OP_LoadGlobalIJumpElseRelCmpConst,
+  OP_LoadGlobalAddConstStoreGlobal,
+  OP_StoreGlobalJumpRel,
+  OP_LoadLocalLoadLocalAddInt,
+  OP_LoadLocalSubConstInt,
+  OP_LoadLocalIJumpElseRelCmpConstInt,
+
+  // Calls followed by a Return, which reuse the frame of the caller
+  OP_TailCall,
+  OP_TailCallGlobal,
+  OP_TailCallLocal,
+
+  OPCODE_COUNT,
 } Opcode;
 
 typedef struct {
@@ -25,18 +25,22 @@ typedef struct {
 CallStack *callstack_new();
 void callstack_free(CallStack *callstack);
 
-static inline Frame pop_frame(Deserialized *mod) {
-  Value clos_env = mod->stack->values[mod->base_pointer];
-
+static inline Frame read_frame(Value clos_env) {
   ASSERT_FMT(get_type(clos_env) == TYPE_FUNCENV, "Expected closure environment got %s", type_of(clos_env));
 
   reg pc = (int16_t) GET_NTH_ELEMENT(clos_env, 0);
   size_t old_sp = (int16_t) GET_NTH_ELEMENT(clos_env, 1);
   size_t base_ptr = (int16_t) GET_NTH_ELEMENT(clos_env, 2);
 
+  return (Frame) { pc, old_sp, base_ptr };
+}
+
+static inline Frame pop_frame(Deserialized *mod) {
+  Frame fr = read_frame(mod->stack->values[mod->base_pointer]);
+
   mod->callstack--;
 
-  return (Frame) { pc, old_sp, base_ptr };
+  return fr;
 }
 
 #endif  // CALLSTACK_H
\ No newline at end of file
@@ -0,0 +1,18 @@
+#ifndef CONSTRUCTORS_H
+#define CONSTRUCTORS_H
+
+#include <module.h>
+
+// ADT values are lists `[special, "Name", fields...]`, and a match arm
+// compares the name of a value with a string constant. Names are tagged at
+// load: every distinct constructor name gets a nonzero integer, stored in
+// the header of the string constants spelling it, so that two tagged names
+// compare by tag instead of by content. The strings themselves are left as
+// they are, for `constructor_name` and natives.
+//
+// Constructor names are the string constants pushed right after a special
+// value, and the ones a match arm compares with or switches on. Names built at run time
+// are untagged and still compare by content.
+void tag_constructors(Deserialized *module);
+
+#endif  // CONSTRUCTORS_H
@@ -3,7 +3,9 @@
 
 #include <stdlib.h>
 
+#ifndef ENABLE_ASSERTIONS
 #define ENABLE_ASSERTIONS 1
+#endif
 
 #define THROW(message)                       \
   do {                                       \
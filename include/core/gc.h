@@ -10,14 +10,37 @@
 #include <stdint.h>
 #include <errno.h>
 #include <setjmp.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <core/log.h>
 
+#if defined(_WIN32) || defined(_WIN64)
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
 struct AllocationMap;
+struct GcSlabHeap;
+struct GcRootSet;
+struct GcNursery;
+struct GcMarkStack;
+struct GcStats;
+struct GcHeapPolicy;
 
 typedef struct GarbageCollector {
-    struct AllocationMap* allocs; // allocation map
+    struct AllocationMap* allocs; // allocation map (large objects)
+    struct GcSlabHeap* slabs;     // size-class slabs (small objects)
+    struct GcRootSet* roots;      // precise root scanners (shared by all copies)
+    struct GcNursery* nursery;    // young generation (shared by all copies)
+    struct GcMarkStack* marking;  // mark work list (shared by all copies)
+    struct GcStats* stats;        // telemetry (shared by all copies)
+    struct GcHeapPolicy* policy;  // heap sizing (shared by all copies)
     bool paused;                  // (temporarily) switch gc on/off
     void *bos;                    // bottom of stack
     size_t min_size;
@@ -36,6 +59,10 @@ static GarbageCollector gc;  // Global garbage collector for all
 // void gc_pause(GarbageCollector* gc);
 // void gc_resume(GarbageCollector* gc);
 // size_t gc_run(GarbageCollector* gc);
+// void gc_set_pause_target(GarbageCollector* gc, double ms);
+// void gc_set_mark_threads(GarbageCollector* gc, size_t threads);
+// void gc_set_heap_policy(GarbageCollector* gc, size_t initial_bytes, size_t max_bytes,
+//                         double growth_factor);
 
 // /*
 //  * Allocating and deallocating memory.
@@ -48,10 +75,38 @@ static GarbageCollector gc;  // Global garbage collector for all
 // void* gc_realloc(GarbageCollector* gc, void* ptr, size_t size);
 // void gc_free(GarbageCollector* gc, void* ptr);
 
+// /*
+//  * Young generation.
+//  */
+// void* gc_malloc_young(GarbageCollector* gc, size_t size, uint8_t kind);
+// void gc_nursery_reserve(GarbageCollector* gc, size_t size);
+// void gc_write_barrier(GarbageCollector* gc, void* obj, uint64_t word);
+// void gc_nursery_pin(GarbageCollector* gc);
+// void gc_nursery_unpin(GarbageCollector* gc);
+
 /*
  * Lifecycle management
  */
 // void* gc_make_static(GarbageCollector* gc, void* ptr);
+// void gc_add_root(GarbageCollector* gc, GcRootFn mark, void* ctx);
+// void gc_remove_root(GarbageCollector* gc, GcRootFn mark, void* ctx);
+
+/*
+ * Precise marking, used by root scanners and object tracers. Stores that
+ * overwrite a reference while `gc_marking` holds must mark the old target.
+ */
+// void gc_set_tracer(GarbageCollector* gc, GcTraceFn trace);
+// bool gc_mark_object(GarbageCollector* gc, void* ptr);
+// void gc_mark_traced(GarbageCollector* gc, void* ptr);
+// void gc_mark_alloc(GarbageCollector* gc, void* ptr);
+// bool gc_marking(GarbageCollector* gc);
+
+/*
+ * Telemetry.
+ */
+// void gc_get_stats(GarbageCollector* gc, GcStats* out);
+// int gc_stats_format(GarbageCollector* gc, char* buf, size_t size);
+// bool gc_stats_write(GarbageCollector* gc, const char* path);
 
 /*
  * Helper functions and stdlib replacements.
@@ -59,6 +114,7 @@ static GarbageCollector gc;  // Global garbage collector for all
 // char* gc_strdup (GarbageCollector* gc, const char* s);
 
 static inline size_t gc_run(GarbageCollector* gc);
+static bool gc_mark_object(GarbageCollector* gc, void* ptr);
 
 #undef LOGLEVEL
 #define LOGLEVEL LOGLEVEL_INFO
@@ -68,6 +124,13 @@ static inline size_t gc_run(GarbageCollector* gc);
  */
 #define PTRSIZE sizeof(char*)
 
+/*
+ * NaN-boxed values keep their heap address in the low 48 bits. Masking a
+ * word with this leaves raw pointers untouched and unboxes boxed ones, which
+ * lets the conservative scanner recognise both.
+ */
+#define GC_PAYLOAD_MASK 0x0000ffffffffffff
+
 /*
  * Allocations can temporarily be tagged as "marked" an part of the
  * mark-and-sweep implementation or can be tagged as "roots" which are
@@ -108,6 +171,250 @@ static size_t next_prime(size_t n)
     return n;
 }
 
+/**
+ * A root scanner.
+ *
+ * Root scanners are registered by the embedder and called at the start of
+ * every mark phase. They mark everything reachable from `ctx` precisely,
+ * using `gc_mark_object` and their own knowledge of the object layout.
+ */
+typedef void (*GcRootFn)(struct GarbageCollector* gc, void* ctx);
+
+typedef struct GcRoot {
+    GcRootFn mark;
+    void* ctx;
+} GcRoot;
+
+typedef struct GcRootSet {
+    size_t size;
+    size_t capacity;
+    GcRoot* roots;
+} GcRootSet;
+
+static GcRootSet* gc_root_set_new(void)
+{
+    GcRootSet* rs = (GcRootSet*) malloc(sizeof(GcRootSet));
+    rs->size = 0;
+    rs->capacity = 8;
+    rs->roots = (GcRoot*) malloc(rs->capacity * sizeof(GcRoot));
+    return rs;
+}
+
+static void gc_root_set_delete(GcRootSet* rs)
+{
+    free(rs->roots);
+    free(rs);
+}
+
+/**
+ * An object tracer.
+ *
+ * Called by the mark loop for every object pushed with `gc_mark_traced`. It
+ * marks the children of `obj` with `gc_mark_traced` or `gc_mark_alloc`,
+ * which only queue them, so tracing never recurses.
+ */
+typedef void (*GcTraceFn)(struct GarbageCollector* gc, void* obj);
+
+/*
+ * Upper bound on the number of entries in the mark work list. Objects that do
+ * not fit are marked but left unscanned, and picked up by a rescan of the
+ * heap once the work list is drained.
+ */
+#ifndef GC_MARK_STACK_MAX
+#define GC_MARK_STACK_MAX ((size_t) 1 << 20)
+#endif
+
+/*
+ * Work list entries are object addresses; the low bit tells objects to be
+ * traced precisely apart from objects to be scanned conservatively.
+ */
+#define GC_MARK_PRECISE ((uintptr_t) 1)
+
+#if defined(__GNUC__) || defined(__clang__)
+#define GC_PREFETCH(p) __builtin_prefetch(p)
+#else
+#define GC_PREFETCH(p) ((void) (p))
+#endif
+
+/*
+ * Incremental marking runs a slice every GC_MARK_STRIDE allocations and
+ * looks at the clock every GC_MARK_CHECK objects within a slice.
+ */
+#ifndef GC_MARK_STRIDE
+#define GC_MARK_STRIDE 1024
+#endif
+#define GC_MARK_CHECK 64
+
+/*
+ * Capacity of the work-stealing deque of each parallel marker, a power of
+ * two. Overflowing objects are handled like an overflow of the serial list.
+ */
+#ifndef GC_MARK_DEQUE_SIZE
+#define GC_MARK_DEQUE_SIZE ((size_t) 1 << 16)
+#endif
+
+struct GcMarkPool;
+
+/*
+ * The work list. The collector's own list is a growable stack used by a
+ * single thread. Parallel markers each own a fixed-size list that is used as
+ * a Chase-Lev deque (`shared`): the owner pushes and pops at `bottom`, other
+ * markers steal from `top`.
+ */
+typedef struct GcMarkStack {
+    uintptr_t* items;
+    size_t size;
+    size_t capacity;
+    bool overflowed;       // an object was marked but could not be queued
+    GcTraceFn trace;       // tracer for precisely marked objects
+    bool active;           // an incremental cycle is in progress
+    uint64_t pause_ns;     // target pause per slice, 0 for stop-the-world
+    size_t countdown;      // allocations until the next slice
+    struct GcMarkPool* pool;  // parallel markers, NULL to mark serially
+    bool shared;           // this is a parallel marker's deque
+    int64_t top;
+    int64_t bottom;
+    size_t marked;         // slab objects marked through this deque
+    size_t marked_bytes;
+} GcMarkStack;
+
+static inline bool gc_marking(GarbageCollector* gc)
+{
+    return gc->marking->active;
+}
+
+static uint64_t gc_clock_ns(void)
+{
+#if defined(_WIN32) || defined(_WIN64)
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (uint64_t) ((double) now.QuadPart * 1e9 / (double) freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+#endif
+}
+
+/*
+ * Pauses are counted in power-of-two buckets: bucket i holds the pauses
+ * shorter than 2^(i+1) microseconds, the last one everything longer.
+ */
+#define GC_PAUSE_BUCKETS 24
+
+/**
+ * Collector statistics, for sizing heaps and catching regressions.
+ *
+ * A pause is every stretch of collector work the mutator waits for: a minor
+ * collection, a full collection or a slice of an incremental one.
+ */
+typedef struct GcStats {
+    uint64_t start_ns;                    // when the collector was started
+    size_t collections;                   // completed major collections
+    size_t minor_collections;
+    uint64_t mark_ns;                     // time spent marking
+    uint64_t sweep_ns;                    // time spent sweeping, lazily or not
+    uint64_t minor_ns;                    // time spent in minor collections
+    size_t pauses;
+    uint64_t pause_total_ns;
+    uint64_t pause_max_ns;
+    size_t pause_histogram[GC_PAUSE_BUCKETS];
+    size_t bytes_allocated;               // in both generations
+    size_t bytes_promoted;                // copied out of the nursery
+    size_t bytes_freed;
+    size_t objects_freed;
+    size_t live_bytes;                    // heap after the last major collection
+    size_t live_objects;
+    size_t heap_objects;                  // objects currently managed
+    size_t heap_bytes;
+    double load_factor;                   // of the allocation map
+} GcStats;
+
+static void gc_stats_pause(GcStats* st, uint64_t ns)
+{
+    size_t bucket = 0;
+    for (uint64_t us = ns / 1000; us > 1 && bucket < GC_PAUSE_BUCKETS - 1; us >>= 1) bucket++;
+    st->pause_histogram[bucket]++;
+    st->pauses++;
+    st->pause_total_ns += ns;
+    if (ns > st->pause_max_ns) st->pause_max_ns = ns;
+}
+
+static GcMarkStack* gc_mark_stack_new(void)
+{
+    GcMarkStack* ms = (GcMarkStack*) calloc(1, sizeof(GcMarkStack));
+    ms->capacity = 1024;
+    ms->items = (uintptr_t*) malloc(ms->capacity * sizeof(uintptr_t));
+    return ms;
+}
+
+static void gc_mark_pool_delete(struct GcMarkPool* pool);
+
+static void gc_mark_stack_delete(GcMarkStack* ms)
+{
+    if (ms->pool) gc_mark_pool_delete(ms->pool);
+    free(ms->items);
+    free(ms);
+}
+
+/*
+ * Threads for the parallel markers.
+ */
+#if defined(_WIN32) || defined(_WIN64)
+typedef HANDLE gc_thread_t;
+typedef SRWLOCK gc_mutex_t;
+typedef CONDITION_VARIABLE gc_cond_t;
+#define gc_mutex_init(m) InitializeSRWLock(m)
+#define gc_mutex_destroy(m) ((void) (m))
+#define gc_mutex_lock(m) AcquireSRWLockExclusive(m)
+#define gc_mutex_unlock(m) ReleaseSRWLockExclusive(m)
+#define gc_cond_init(c) InitializeConditionVariable(c)
+#define gc_cond_destroy(c) ((void) (c))
+#define gc_cond_wait(c, m) SleepConditionVariableSRW(c, m, INFINITE, 0)
+#define gc_cond_broadcast(c) WakeAllConditionVariable(c)
+#define gc_thread_yield() SwitchToThread()
+#else
+typedef pthread_t gc_thread_t;
+typedef pthread_mutex_t gc_mutex_t;
+typedef pthread_cond_t gc_cond_t;
+#define gc_mutex_init(m) pthread_mutex_init(m, NULL)
+#define gc_mutex_destroy(m) pthread_mutex_destroy(m)
+#define gc_mutex_lock(m) pthread_mutex_lock(m)
+#define gc_mutex_unlock(m) pthread_mutex_unlock(m)
+#define gc_cond_init(c) pthread_cond_init(c, NULL)
+#define gc_cond_destroy(c) pthread_cond_destroy(c)
+#define gc_cond_wait(c, m) pthread_cond_wait(c, m)
+#define gc_cond_broadcast(c) pthread_cond_broadcast(c)
+#define gc_thread_yield() sched_yield()
+#endif
+
+typedef struct GcMarkWorker {
+    GcMarkStack stack;          // this marker's deque
+    GarbageCollector gc;        // collector handle whose `marking` is `stack`
+    struct GcMarkPool* pool;
+    size_t index;
+    gc_thread_t thread;
+} GcMarkWorker;
+
+/**
+ * The parallel markers.
+ *
+ * Worker 0 is the collecting thread itself, the others are pool threads that
+ * sleep until the collector starts a round by bumping `round`.
+ */
+typedef struct GcMarkPool {
+    size_t size;
+    GcMarkWorker* workers;
+    gc_mutex_t lock;
+    gc_cond_t start;
+    gc_cond_t done;
+    uint64_t round;
+    size_t running;             // pool threads still marking in this round
+    size_t idle;                // markers out of work, for termination
+    bool shutdown;
+} GcMarkPool;
+
 /**
  * The allocation object.
  *
@@ -172,6 +479,7 @@ typedef struct AllocationMap {
     double sweep_factor;
     size_t sweep_limit;
     size_t size;
+    size_t bytes;  // sum of the sizes of all allocations
     Allocation** allocs;
 } AllocationMap;
 
@@ -205,6 +513,7 @@ static AllocationMap* gc_allocation_map_new(size_t min_capacity,
     am->upsize_factor = upsize_factor;
     am->allocs = (Allocation**) calloc(am->capacity, sizeof(Allocation*));
     am->size = 0;
+    am->bytes = 0;
     LOG_DEBUG("Created allocation map (cap=%ld, siz=%ld)", am->capacity, am->size);
     return am;
 }
@@ -235,6 +544,21 @@ static size_t gc_hash(void *ptr)
     return ((uintptr_t)ptr) >> 3;
 }
 
+/**
+ * Recompute the high-water mark after a sweep.
+ *
+ * `live` counts the surviving objects of both the map and the slabs. The
+ * limit leaves room for `sweep_factor` of the free capacity. Once the live
+ * set outgrows the capacity, the headroom scales with the live set instead,
+ * so that a large live heap does not trigger a collection on every
+ * allocation.
+ */
+static void gc_allocation_map_update_sweep_limit(AllocationMap* am, size_t live)
+{
+    size_t headroom = am->capacity > live ? am->capacity - live : live;
+    am->sweep_limit = live + am->sweep_factor * headroom;
+}
+
 static void gc_allocation_map_resize(AllocationMap* am, size_t new_capacity)
 {
     if (new_capacity <= am->min_capacity) {
@@ -259,7 +583,6 @@ static void gc_allocation_map_resize(AllocationMap* am, size_t new_capacity)
     free(am->allocs);
     am->capacity = new_capacity;
     am->allocs = resized_allocs;
-    am->sweep_limit = am->size + am->sweep_factor * (am->capacity - am->size);
 }
 
 static bool gc_allocation_map_resize_to_fit(AllocationMap* am)
@@ -299,6 +622,7 @@ static Allocation* gc_allocation_map_put(AllocationMap* am,
         void (*dtor)(void*))
 {
     size_t index = gc_hash(ptr) % am->capacity;
+    am->bytes += size;
     LOG_DEBUG("PUT request for allocation ix=%ld", index);
     Allocation* alloc = gc_allocation_new(ptr, size, dtor);
     Allocation* cur = am->allocs[index];
@@ -307,6 +631,7 @@ static Allocation* gc_allocation_map_put(AllocationMap* am,
     while(cur != NULL) {
         if (cur->ptr == ptr) {
             // found it
+            am->bytes -= cur->size;
             alloc->next = cur->next;
             if (!prev) {
                 // position 0
@@ -357,6 +682,7 @@ static void gc_allocation_map_remove(AllocationMap* am,
                 // not the first item in the list
                 prev->next = cur->next;
             }
+            am->bytes -= cur->size;
             gc_allocation_delete(cur);
             am->size--;
         } else {
@@ -371,15 +697,436 @@ static void gc_allocation_map_remove(AllocationMap* am,
 }
 
 
+/*
+ * Small objects are served from size-segregated slabs carved out of a single
+ * reserved address range. Every slab holds objects of one size class and
+ * keeps allocation, mark and root bits in bitmaps in its header, so that
+ * identifying a managed pointer is a range check and sweeping is a linear
+ * walk over the bitmaps.
+ *
+ * Larger objects and objects with a destructor stay in the allocation map.
+ */
+#ifndef GC_SLAB_ARENA_SIZE
+#define GC_SLAB_ARENA_SIZE ((size_t) 1 << 32)
+#endif
+#define GC_SLAB_SIZE ((size_t) 1 << 16)
+#define GC_SLAB_MIN_OBJECT 16
+#define GC_SLAB_MAX_OBJECT 2048
+#define GC_SLAB_BITMAP_WORDS (GC_SLAB_SIZE / GC_SLAB_MIN_OBJECT / 64)
+#define GC_SLAB_EMPTY 0xff
+
+static const uint32_t gc_size_classes[] = {
+    16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256,
+    320, 384, 448, 512, 768, 1024, 1536, 2048
+};
+
+#define GC_SIZE_CLASSES (sizeof(gc_size_classes) / sizeof(gc_size_classes[0]))
+
+typedef struct GcSlab {
+    uint32_t object_size;
+    uint32_t capacity;       // number of objects in the slab
+    uint32_t live;           // number of allocated objects
+    uint8_t size_class;      // GC_SLAB_EMPTY while the slab is unused
+    uint8_t pending;         // queued for sweeping, free objects not listed yet
+    struct GcSlab* next;     // next empty or unswept slab
+    uint64_t alloc[GC_SLAB_BITMAP_WORDS];
+    uint64_t mark[GC_SLAB_BITMAP_WORDS];
+    uint64_t root[GC_SLAB_BITMAP_WORDS];
+} GcSlab;
+
+#define GC_SLAB_HEADER ((sizeof(GcSlab) + 15) & ~(size_t) 15)
+
+typedef struct GcSlabHeap {
+    char* base;                       // the reservation as returned by the OS
+    char* start;                      // first slab, GC_SLAB_SIZE aligned
+    char* top;                        // end of the slabs in use
+    char* end;                        // end of the reservation
+    GcSlab* empty;                    // unused slabs, available to any class
+    GcSlab* unswept[GC_SIZE_CLASSES]; // slabs still holding the last cycle's marks
+    void* free[GC_SIZE_CLASSES];      // free objects, linked through their first word
+    size_t live;                      // allocated objects in all slabs, not counting
+                                      // the dead ones in unswept slabs
+    size_t live_bytes;                // and their size
+    size_t marked;                    // objects marked in the current cycle
+    size_t marked_bytes;
+    size_t freed_objects;             // totals, for the statistics
+    size_t freed_bytes;
+    uint64_t sweep_ns;
+    uint8_t class_of[GC_SLAB_MAX_OBJECT / 8 + 1];
+} GcSlabHeap;
+
+static inline bool gc_bit_test(const uint64_t* bitmap, size_t i)
+{
+    return (bitmap[i / 64] >> (i % 64)) & 1;
+}
+
+static inline void gc_bit_set(uint64_t* bitmap, size_t i)
+{
+    bitmap[i / 64] |= (uint64_t) 1 << (i % 64);
+}
+
+static inline void gc_bit_clear(uint64_t* bitmap, size_t i)
+{
+    bitmap[i / 64] &= ~((uint64_t) 1 << (i % 64));
+}
+
+static void* gc_os_reserve(size_t size)
+{
+#if defined(_WIN32) || defined(_WIN64)
+    return VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS);
+#else
+    void* p = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return p == MAP_FAILED ? NULL : p;
+#endif
+}
+
+static bool gc_os_commit(void* p, size_t size)
+{
+#if defined(_WIN32) || defined(_WIN64)
+    return VirtualAlloc(p, size, MEM_COMMIT, PAGE_READWRITE) != NULL;
+#else
+    return mprotect(p, size, PROT_READ | PROT_WRITE) == 0;
+#endif
+}
+
+static void gc_os_release(void* p, size_t size)
+{
+#if defined(_WIN32) || defined(_WIN64)
+    (void) size;
+    VirtualFree(p, 0, MEM_RELEASE);
+#else
+    munmap(p, size);
+#endif
+}
+
+static GcSlabHeap* gc_slab_heap_new(void)
+{
+    GcSlabHeap* h = (GcSlabHeap*) calloc(1, sizeof(GcSlabHeap));
+    for (size_t i = 0, c = 0; i <= GC_SLAB_MAX_OBJECT / 8; ++i) {
+        while (gc_size_classes[c] < i * 8) c++;
+        h->class_of[i] = (uint8_t) c;
+    }
+    h->base = (char*) gc_os_reserve(GC_SLAB_ARENA_SIZE + GC_SLAB_SIZE);
+    if (!h->base) {
+        /* Without an arena every allocation goes through the allocation map */
+        LOG_WARNING("Failed to reserve %zu bytes for the slab heap", (size_t) GC_SLAB_ARENA_SIZE);
+        return h;
+    }
+    h->start = (char*) (((uintptr_t) h->base + GC_SLAB_SIZE - 1) & ~(uintptr_t) (GC_SLAB_SIZE - 1));
+    h->top = h->start;
+    h->end = h->start + GC_SLAB_ARENA_SIZE;
+    return h;
+}
+
+static void gc_slab_heap_delete(GcSlabHeap* h)
+{
+    if (h->base) gc_os_release(h->base, GC_SLAB_ARENA_SIZE + GC_SLAB_SIZE);
+    free(h);
+}
+
+/**
+ * Return the slab `ptr` points into, or NULL if it is outside the slab heap.
+ */
+static inline GcSlab* gc_slab_of(GcSlabHeap* h, void* ptr)
+{
+    if ((uintptr_t) ptr - (uintptr_t) h->start >= (uintptr_t) h->top - (uintptr_t) h->start) {
+        return NULL;
+    }
+    return (GcSlab*) ((uintptr_t) ptr & ~(uintptr_t) (GC_SLAB_SIZE - 1));
+}
+
+/**
+ * Return the index of the allocated object starting at `ptr`, or -1 if
+ * `ptr` does not point to the start of a live object.
+ */
+static inline long gc_slab_index(GcSlab* s, void* ptr)
+{
+    size_t offset = (size_t) ((char*) ptr - (char*) s);
+    if (s->size_class == GC_SLAB_EMPTY || offset < GC_SLAB_HEADER) return -1;
+    offset -= GC_SLAB_HEADER;
+    size_t i = offset / s->object_size;
+    if (i * s->object_size != offset || i >= s->capacity || !gc_bit_test(s->alloc, i)) {
+        return -1;
+    }
+    return (long) i;
+}
+
+static inline void* gc_slab_object(GcSlab* s, size_t i)
+{
+    return (char*) s + GC_SLAB_HEADER + i * s->object_size;
+}
+
+/**
+ * Hand a slab to size class `c` and thread all of its objects onto the
+ * free list of that class.
+ */
+static bool gc_slab_refill(GcSlabHeap* h, uint8_t c)
+{
+    GcSlab* s = h->empty;
+    if (s) {
+        h->empty = s->next;
+    } else {
+        if (h->top == h->end || !gc_os_commit(h->top, GC_SLAB_SIZE)) return false;
+        s = (GcSlab*) h->top;
+        h->top += GC_SLAB_SIZE;
+    }
+    memset(s, 0, sizeof(GcSlab));
+    s->size_class = c;
+    s->object_size = gc_size_classes[c];
+    s->capacity = (uint32_t) ((GC_SLAB_SIZE - GC_SLAB_HEADER) / s->object_size);
+    for (size_t i = s->capacity; i-- > 0; ) {
+        void* obj = gc_slab_object(s, i);
+        *(void**) obj = h->free[c];
+        h->free[c] = obj;
+    }
+    return true;
+}
+
+static void gc_slab_free(GcSlabHeap* h, GcSlab* s, size_t i)
+{
+    void* obj = gc_slab_object(s, i);
+    gc_bit_clear(s->alloc, i);
+    gc_bit_clear(s->mark, i);
+    gc_bit_clear(s->root, i);
+    if (!s->pending) {
+        *(void**) obj = h->free[s->size_class];
+        h->free[s->size_class] = obj;
+    }
+    s->live--;
+    h->live--;
+    h->live_bytes -= s->object_size;
+}
+
+/**
+ * Mark the slab object at `ptr`, returns true if it was marked by this call.
+ */
+static inline bool gc_slab_mark(GcSlab* s, void* ptr)
+{
+    long i = gc_slab_index(s, ptr);
+    if (i < 0 || gc_bit_test(s->mark, i)) return false;
+    gc_bit_set(s->mark, i);
+    return true;
+}
+
+/**
+ * Free every unmarked, non-root object of a slab and put the free objects
+ * on the free list of its class. A slab without survivors is returned to
+ * the pool of empty slabs.
+ *
+ * @returns The number of bytes freed.
+ */
+static size_t gc_slab_sweep(GcSlabHeap* h, GcSlab* s)
+{
+    size_t words = (s->capacity + 63) / 64;
+    size_t freed = 0;
+    uint32_t live = 0;
+    for (size_t w = 0; w < words; ++w) {
+        uint64_t keep = s->alloc[w] & (s->mark[w] | s->root[w]);
+        freed += (size_t) __builtin_popcountll(s->alloc[w] & ~keep);
+        live += (uint32_t) __builtin_popcountll(keep);
+        s->alloc[w] = keep;
+        s->mark[w] = 0;
+    }
+    s->live = live;
+    s->pending = 0;
+    h->freed_objects += freed;
+    h->freed_bytes += freed * s->object_size;
+    if (!live) {
+        s->size_class = GC_SLAB_EMPTY;
+        s->next = h->empty;
+        h->empty = s;
+        return freed * s->object_size;
+    }
+    for (size_t i = s->capacity; i-- > 0; ) {
+        if (gc_bit_test(s->alloc, i)) continue;
+        void* obj = gc_slab_object(s, i);
+        *(void**) obj = h->free[s->size_class];
+        h->free[s->size_class] = obj;
+    }
+    return freed * s->object_size;
+}
+
+/**
+ * End a mark cycle for the slabs.
+ *
+ * Nothing is freed here: every slab in use is queued for sweeping, and the
+ * allocator sweeps a slab of the requested class whenever its free list runs
+ * dry. Survivors are known from the mark count, so the heap size is exact
+ * without touching the slabs.
+ */
+static void gc_slab_sweep_begin(GcSlabHeap* h)
+{
+    memset(h->free, 0, sizeof(h->free));
+    for (char* p = h->top; p > h->start; ) {
+        p -= GC_SLAB_SIZE;
+        GcSlab* s = (GcSlab*) p;
+        if (s->size_class == GC_SLAB_EMPTY) continue;
+        s->pending = 1;
+        s->next = h->unswept[s->size_class];
+        h->unswept[s->size_class] = s;
+    }
+    h->live = h->marked;
+    h->live_bytes = h->marked_bytes;
+    h->marked = 0;
+    h->marked_bytes = 0;
+}
+
+/**
+ * Sweep all slabs that are still pending, e.g. before the next mark cycle.
+ *
+ * @returns The number of bytes freed.
+ */
+static size_t gc_slab_sweep_pending(GcSlabHeap* h)
+{
+    uint64_t start = gc_clock_ns();
+    size_t total = 0;
+    for (size_t c = 0; c < GC_SIZE_CLASSES; ++c) {
+        while (h->unswept[c]) {
+            GcSlab* s = h->unswept[c];
+            h->unswept[c] = s->next;
+            total += gc_slab_sweep(h, s);
+        }
+    }
+    h->sweep_ns += gc_clock_ns() - start;
+    return total;
+}
+
+static void* gc_slab_alloc(GcSlabHeap* h, size_t size)
+{
+    uint8_t c = h->class_of[(size + 7) / 8];
+    if (!h->free[c] && h->unswept[c]) {
+        uint64_t start = gc_clock_ns();
+        while (!h->free[c] && h->unswept[c]) {
+            GcSlab* s = h->unswept[c];
+            h->unswept[c] = s->next;
+            gc_slab_sweep(h, s);
+        }
+        h->sweep_ns += gc_clock_ns() - start;
+    }
+    if (!h->free[c] && !gc_slab_refill(h, c)) return NULL;
+    void* obj = h->free[c];
+    h->free[c] = *(void**) obj;
+    GcSlab* s = gc_slab_of(h, obj);
+    gc_bit_set(s->alloc, ((char*) obj - (char*) s - GC_SLAB_HEADER) / s->object_size);
+    s->live++;
+    h->live++;
+    h->live_bytes += s->object_size;
+    return obj;
+}
+
 static void* gc_mcalloc(size_t count, size_t size)
 {
     if (!count) return malloc(size);
     return calloc(count, size);
 }
 
+static inline size_t gc_live_objects(GarbageCollector* gc)
+{
+    return gc->allocs->size + gc->slabs->live;
+}
+
+static inline size_t gc_heap_bytes(GarbageCollector* gc)
+{
+    return gc->allocs->bytes + gc->slabs->live_bytes;
+}
+
+/**
+ * The heap sizing policy.
+ *
+ * Without an initial heap size, a collection is due when the number of
+ * objects exceeds the sweep limit of the allocation map. With one, it is due
+ * when the heap exceeds `trigger_bytes`, which every collection resets to
+ * `growth_factor` times the surviving bytes, but never below the initial
+ * size nor above the maximum. Objects still in the nursery are not counted,
+ * the nursery has a fixed size of its own.
+ */
+typedef struct GcHeapPolicy {
+    size_t initial_bytes;  // 0 to trigger on object counts
+    size_t max_bytes;      // hard limit, 0 for none
+    double growth_factor;
+    size_t trigger_bytes;
+} GcHeapPolicy;
+
+static void gc_heap_policy_update(GcHeapPolicy* p, size_t live)
+{
+    if (!p->initial_bytes) return;
+    size_t trigger = (size_t) (live * p->growth_factor);
+    if (trigger < p->initial_bytes) trigger = p->initial_bytes;
+    if (p->max_bytes && trigger > p->max_bytes) trigger = p->max_bytes;
+    p->trigger_bytes = trigger;
+}
+
 static bool gc_needs_sweep(GarbageCollector* gc)
 {
-    return gc->allocs->size > gc->allocs->sweep_limit;
+    if (gc->policy->initial_bytes) return gc_heap_bytes(gc) > gc->policy->trigger_bytes;
+    return gc_live_objects(gc) > gc->allocs->sweep_limit;
+}
+
+/**
+ * Whether the heap has outgrown its limit so far that an incremental cycle
+ * has to be finished right away.
+ */
+static bool gc_sweep_overdue(GarbageCollector* gc)
+{
+    if (gc->policy->initial_bytes) return gc_heap_bytes(gc) > 2 * gc->policy->trigger_bytes;
+    return gc_live_objects(gc) > 2 * gc->allocs->sweep_limit;
+}
+
+static size_t gc_collect(GarbageCollector* gc);
+
+/**
+ * Allocate and manage `size` bytes without ever triggering a collection.
+ *
+ * Objects allocated while an incremental cycle is in progress are marked
+ * right away, they were not part of the snapshot being traced.
+ */
+static void* gc_allocate_raw(GarbageCollector* gc, size_t size)
+{
+    if (size <= GC_SLAB_MAX_OBJECT) {
+        void* ptr = gc_slab_alloc(gc->slabs, size);
+        if (ptr) {
+            if (gc_marking(gc)) gc_mark_object(gc, ptr);
+            return ptr;
+        }
+    }
+    void* ptr = malloc(size);
+    if (!ptr) return NULL;
+    Allocation* alloc = gc_allocation_map_put(gc->allocs, ptr, size, NULL);
+    if (!alloc) {
+        free(ptr);
+        return NULL;
+    }
+    if (gc_marking(gc)) alloc->tag |= GC_TAG_MARK;
+    return alloc->ptr;
+}
+
+/**
+ * Fail if `size` more bytes do not fit under the hard heap limit. Running
+ * out of heap is fatal.
+ */
+static void gc_heap_check(GarbageCollector* gc, size_t size)
+{
+    size_t max = gc->policy->max_bytes;
+    if (gc_heap_bytes(gc) + size > max) {
+        fprintf(stderr, "Out of memory: allocating %zu bytes would exceed the heap limit "
+                "of %zu bytes (%zu bytes live)\n", size, max, gc_heap_bytes(gc));
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Make sure `size` more bytes fit under the hard heap limit, collecting
+ * whatever can be collected if they do not.
+ */
+static void gc_heap_reserve(GarbageCollector* gc, size_t size)
+{
+    if (gc_heap_bytes(gc) + size <= gc->policy->max_bytes) return;
+    if (!gc->paused) {
+        uint64_t start = gc_clock_ns();
+        gc_run(gc);
+        gc_stats_pause(gc->stats, gc_clock_ns() - start);
+    }
+    gc_heap_check(gc, size);
 }
 
 static void* gc_allocate(GarbageCollector* gc, size_t count, size_t size, void(*dtor)(void*))
@@ -387,13 +1134,24 @@ static void* gc_allocate(GarbageCollector* gc, size_t count, size_t size, void(*
     /* Allocation logic that generalizes over malloc/calloc. */
 
     /* Check if we reached the high-water mark and need to clean up */
-    if (gc_needs_sweep(gc) && !gc->paused) {
-        size_t freed_mem = gc_run(gc);
+    size_t freed_mem = gc_collect(gc);
+    if (freed_mem) {
         LOG_DEBUG("Garbage collection cleaned up %lu bytes.", freed_mem);
     }
+    size_t alloc_size = count ? count * size : size;
+    if (gc->policy->max_bytes) gc_heap_reserve(gc, alloc_size);
+    gc->stats->bytes_allocated += alloc_size;
+    /* Small objects without a destructor go to the slabs */
+    if (!dtor && alloc_size <= GC_SLAB_MAX_OBJECT) {
+        void* ptr = gc_slab_alloc(gc->slabs, alloc_size);
+        if (ptr) {
+            if (count) memset(ptr, 0, alloc_size);
+            if (gc_marking(gc)) gc_mark_object(gc, ptr);
+            return ptr;
+        }
+    }
     /* With cleanup out of the way, attempt to allocate memory */
     void* ptr = gc_mcalloc(count, size);
-    size_t alloc_size = count ? count * size : size;
     /* If allocation fails, force an out-of-policy run to free some memory and try again. */
     if (!ptr && !gc->paused && (errno == EAGAIN || errno == ENOMEM)) {
         gc_run(gc);
@@ -406,6 +1164,7 @@ static void* gc_allocate(GarbageCollector* gc, size_t count, size_t size, void(*
         /* Deal with metadata allocation failure */
         if (alloc) {
             LOG_DEBUG("Managing %zu bytes at %p", alloc_size, (void*) alloc->ptr);
+            if (gc_marking(gc)) alloc->tag |= GC_TAG_MARK;
             ptr = alloc->ptr;
         } else {
             /* We failed to allocate the metadata, fail cleanly. */
@@ -418,6 +1177,12 @@ static void* gc_allocate(GarbageCollector* gc, size_t count, size_t size, void(*
 
 static void gc_make_root(GarbageCollector* gc, void* ptr)
 {
+    GcSlab* s = gc_slab_of(gc->slabs, ptr);
+    if (s) {
+        long i = gc_slab_index(s, ptr);
+        if (i >= 0) gc_bit_set(s->root, i);
+        return;
+    }
     Allocation* alloc = gc_allocation_map_get(gc->allocs, ptr);
     if (alloc) {
         alloc->tag |= GC_TAG_ROOT;
@@ -461,12 +1226,31 @@ static void* gc_calloc(GarbageCollector* gc, size_t count, size_t size)
 
 static void* gc_realloc(GarbageCollector* gc, void* p, size_t size)
 {
+    GcSlab* s = gc_slab_of(gc->slabs, p);
+    if (s) {
+        long i = gc_slab_index(s, p);
+        if (i < 0) {
+            errno = EINVAL;
+            return NULL;
+        }
+        if (size <= s->object_size) return p;
+        // No collection here, which could free `p`
+        if (gc->policy->max_bytes) gc_heap_check(gc, size);
+        void* q = gc_allocate_raw(gc, size);
+        if (!q) return NULL;
+        memcpy(q, p, s->object_size);
+        if (gc_bit_test(s->root, i)) gc_make_root(gc, q);
+        gc_slab_free(gc->slabs, s, i);
+        return q;
+    }
     Allocation* alloc = gc_allocation_map_get(gc->allocs, p);
     if (p && !alloc) {
         // the user passed an unknown pointer
         errno = EINVAL;
         return NULL;
     }
+    size_t old_size = alloc ? alloc->size : 0;
+    if (gc->policy->max_bytes && size > old_size) gc_heap_check(gc, size - old_size);
     void* q = realloc(p, size);
     if (!q) {
         // realloc failed but p is still valid
@@ -479,6 +1263,7 @@ static void* gc_realloc(GarbageCollector* gc, void* p, size_t size)
     }
     if (p == q) {
         // successful reallocation w/o copy
+        gc->allocs->bytes += size - alloc->size;
         alloc->size = size;
     } else {
         // successful reallocation w/ copy
@@ -491,6 +1276,16 @@ static void* gc_realloc(GarbageCollector* gc, void* p, size_t size)
 
 static void gc_free(GarbageCollector* gc, void* ptr)
 {
+    GcSlab* s = gc_slab_of(gc->slabs, ptr);
+    if (s) {
+        long i = gc_slab_index(s, ptr);
+        if (i >= 0) {
+            gc_slab_free(gc->slabs, s, i);
+        } else {
+            LOG_WARNING("Ignoring request to free unknown pointer %p", (void*) ptr);
+        }
+        return;
+    }
     Allocation* alloc = gc_allocation_map_get(gc->allocs, ptr);
     if (alloc) {
         if (alloc->dtor) {
@@ -503,9 +1298,320 @@ static void gc_free(GarbageCollector* gc, void* ptr)
     }
 }
 
-static void gc_start_ext(GarbageCollector* gc,
-                  void* bos,
-                  size_t initial_capacity,
+/*
+ * Default size of the young generation. Small enough to stay cache resident,
+ * large enough for most short-lived values to die before a minor collection.
+ */
+#ifndef GC_NURSERY_SIZE
+#define GC_NURSERY_SIZE (1 << 20)
+#endif
+
+/**
+ * The header in front of every object in the nursery.
+ *
+ * `kind` is defined by the embedder and lets its scavenger tell objects
+ * apart while walking the nursery. Once an object is promoted its first
+ * word is overwritten with the address of the promoted copy.
+ */
+typedef struct GcYoungHeader {
+    uint32_t size;      // object size in bytes, excluding the header
+    uint8_t kind;       // embedder-defined object kind
+    uint8_t forwarded;  // set once the object has been promoted
+} GcYoungHeader;
+
+/**
+ * The young generation.
+ *
+ * A single bump-pointer region owned by the interpreter thread. Survivors of
+ * a minor collection are promoted into the mark-and-sweep space. Objects of
+ * the old generation that may point into the nursery are kept in the
+ * remembered set.
+ *
+ * The collector does not know the layout of young objects, the embedder
+ * installs a scavenger that evacuates its roots and the remembered set with
+ * `gc_young_promote`, then drains the grey list.
+ */
+typedef struct GcNursery {
+    char* start;
+    char* top;
+    char* end;
+    size_t pinned;              // > 0 while young objects must not move, atomic
+    GcRootFn scavenge;          // embedder-provided minor collection
+    void* scavenge_ctx;
+    void** remembered;          // old objects that may point into the nursery
+    size_t remembered_size;
+    size_t remembered_capacity;
+    void** grey;                // promoted objects whose fields are not scanned yet
+    size_t grey_size;
+    size_t grey_capacity;
+} GcNursery;
+
+static GcNursery* gc_nursery_new(size_t size)
+{
+    GcNursery* n = (GcNursery*) calloc(1, sizeof(GcNursery));
+    n->start = (char*) malloc(size);
+    n->top = n->start;
+    n->end = n->start + size;
+    n->remembered_capacity = 64;
+    n->remembered = (void**) malloc(n->remembered_capacity * sizeof(void*));
+    n->grey_capacity = 64;
+    n->grey = (void**) malloc(n->grey_capacity * sizeof(void*));
+    return n;
+}
+
+static void gc_nursery_delete(GcNursery* n)
+{
+    free(n->start);
+    free(n->remembered);
+    free(n->grey);
+    free(n);
+}
+
+static inline size_t gc_young_size(size_t size)
+{
+    size = size < PTRSIZE ? PTRSIZE : (size + PTRSIZE - 1) & ~(PTRSIZE - 1);
+    return sizeof(GcYoungHeader) + size;
+}
+
+static inline GcYoungHeader* gc_young_header(void* ptr)
+{
+    return (GcYoungHeader*) ptr - 1;
+}
+
+static inline bool gc_is_young(GarbageCollector* gc, void* ptr)
+{
+    GcNursery* n = gc->nursery;
+    return n && (char*) ptr >= n->start && (char*) ptr < n->top;
+}
+
+static void gc_nursery_set_scavenger(GarbageCollector* gc, GcRootFn scavenge, void* ctx)
+{
+    gc->nursery->scavenge = scavenge;
+    gc->nursery->scavenge_ctx = ctx;
+}
+
+static inline bool gc_nursery_pinned(GcNursery* n)
+{
+    return __atomic_load_n(&n->pinned, __ATOMIC_ACQUIRE) != 0;
+}
+
+/**
+ * Keep young objects in place.
+ *
+ * Pinning is required while code that is not known to the scavenger (native
+ * functions, interpreters on other threads) may hold young pointers. While
+ * the nursery is pinned, young allocations go to the old generation. Any
+ * thread may pin and unpin, the count is updated atomically.
+ */
+static inline void gc_nursery_pin(GarbageCollector* gc)
+{
+    if (gc->nursery) __atomic_add_fetch(&gc->nursery->pinned, 1, __ATOMIC_ACQ_REL);
+}
+
+static inline void gc_nursery_unpin(GarbageCollector* gc)
+{
+    if (gc->nursery) __atomic_sub_fetch(&gc->nursery->pinned, 1, __ATOMIC_ACQ_REL);
+}
+
+static void gc_remember(GarbageCollector* gc, void* obj)
+{
+    GcNursery* n = gc->nursery;
+    if (n->remembered_size == n->remembered_capacity) {
+        n->remembered_capacity *= 2;
+        n->remembered = (void**) realloc(n->remembered, n->remembered_capacity * sizeof(void*));
+    }
+    n->remembered[n->remembered_size++] = obj;
+}
+
+/**
+ * Record a store of `word` into the old object `obj`.
+ *
+ * Must be called whenever a possibly young value is written into an object
+ * that may already live in the old generation.
+ */
+static inline void gc_write_barrier(GarbageCollector* gc, void* obj, uint64_t word)
+{
+    if (gc_is_young(gc, (void*) (uintptr_t) (word & GC_PAYLOAD_MASK)) && !gc_is_young(gc, obj)) {
+        gc_remember(gc, obj);
+    }
+}
+
+static inline void gc_grey_push(GarbageCollector* gc, void* obj)
+{
+    GcNursery* n = gc->nursery;
+    if (n->grey_size == n->grey_capacity) {
+        n->grey_capacity *= 2;
+        n->grey = (void**) realloc(n->grey, n->grey_capacity * sizeof(void*));
+    }
+    n->grey[n->grey_size++] = obj;
+}
+
+static inline void* gc_grey_pop(GarbageCollector* gc)
+{
+    GcNursery* n = gc->nursery;
+    return n->grey_size ? n->grey[--n->grey_size] : NULL;
+}
+
+/**
+ * Return the promoted copy of a young object, or NULL if it was not
+ * promoted yet.
+ */
+static inline void* gc_young_forwarded(void* ptr)
+{
+    return gc_young_header(ptr)->forwarded ? *(void**) ptr : NULL;
+}
+
+/**
+ * Copy a young object into the old generation.
+ *
+ * The copy is managed like any `gc_malloc` allocation and a forwarding
+ * pointer is left behind. Promotion never triggers a collection.
+ */
+static void* gc_young_promote(GarbageCollector* gc, void* ptr)
+{
+    GcYoungHeader* h = gc_young_header(ptr);
+    void* q = gc_allocate_raw(gc, h->size);
+    if (!q) {
+        LOG_CRITICAL("Failed to promote %u bytes from the nursery", h->size);
+        exit(EXIT_FAILURE);
+    }
+    memcpy(q, ptr, h->size);
+    gc->stats->bytes_promoted += h->size;
+    h->forwarded = 1;
+    *(void**) ptr = q;
+    return q;
+}
+
+/**
+ * Walk every object currently allocated in the nursery.
+ */
+static void gc_nursery_walk(GarbageCollector* gc,
+                            void (*visit)(GarbageCollector*, void*, uint8_t, size_t))
+{
+    GcNursery* n = gc->nursery;
+    for (char* p = n->start; p < n->top; ) {
+        GcYoungHeader* h = (GcYoungHeader*) p;
+        visit(gc, h + 1, h->kind, h->size);
+        p += sizeof(GcYoungHeader) + h->size;
+    }
+}
+
+/**
+ * Run a minor collection.
+ *
+ * Evacuates all reachable young objects into the old generation and resets
+ * the bump pointer. Promotion may push the old generation over its sweep
+ * limit, in which case a major collection (or a slice of an incremental one)
+ * follows on the now empty nursery.
+ */
+static void gc_minor(GarbageCollector* gc)
+{
+    GcNursery* n = gc->nursery;
+    LOG_DEBUG("Initiating minor GC (%ld bytes young)", (long) (n->top - n->start));
+    uint64_t start = gc_clock_ns();
+    // Promotion cannot collect, so the heap limit must hold even if every
+    // young object survives
+    if (gc->policy->max_bytes) gc_heap_reserve(gc, n->top - n->start);
+    n->scavenge(gc, n->scavenge_ctx);
+    gc->stats->bytes_allocated += n->top - n->start;
+    n->top = n->start;
+    n->remembered_size = 0;
+    n->grey_size = 0;
+    uint64_t elapsed = gc_clock_ns() - start;
+    gc->stats->minor_collections++;
+    gc->stats->minor_ns += elapsed;
+    gc_stats_pause(gc->stats, elapsed);
+    gc_collect(gc);
+}
+
+static inline bool gc_nursery_usable(GcNursery* n, size_t size)
+{
+    return n && !gc_nursery_pinned(n) && n->scavenge && size <= (size_t) (n->end - n->start) / 16;
+}
+
+/**
+ * The number of nursery bytes an allocation of `size` bytes takes, zero if
+ * it would be served by the old generation.
+ */
+static inline size_t gc_young_footprint(GarbageCollector* gc, size_t size)
+{
+    size_t total = gc_young_size(size);
+    return gc_nursery_usable(gc->nursery, total) ? total : 0;
+}
+
+/**
+ * Make sure the next `size` bytes of young allocations (as computed by
+ * `gc_young_footprint`) do not trigger a minor collection.
+ *
+ * Callers that hold young pointers in C locals between allocations must
+ * reserve the whole batch upfront, as a minor collection moves objects.
+ */
+static inline void gc_nursery_reserve(GarbageCollector* gc, size_t size)
+{
+    GcNursery* n = gc->nursery;
+    if (n && !gc_nursery_pinned(n) && n->scavenge && n->top + size > n->end) {
+        gc_minor(gc);
+    }
+}
+
+/**
+ * Allocate a short-lived object in the nursery.
+ *
+ * Falls back to `gc_malloc` for large objects, or if the nursery is pinned
+ * or has no scavenger. Callers must issue a write barrier for young values
+ * stored into the result unless `gc_is_young` holds for it.
+ */
+static inline void* gc_malloc_young(GarbageCollector* gc, size_t size, uint8_t kind)
+{
+    GcNursery* n = gc->nursery;
+    size_t total = gc_young_size(size);
+    if (!gc_nursery_usable(n, total)) {
+        return gc_malloc(gc, size);
+    }
+    if (n->top + total > n->end) {
+        gc_minor(gc);
+    }
+    GcYoungHeader* h = (GcYoungHeader*) n->top;
+    n->top += total;
+    h->size = (uint32_t) (total - sizeof(GcYoungHeader));
+    h->kind = kind;
+    h->forwarded = 0;
+    return h + 1;
+}
+
+/**
+ * Whether `ptr` survives the current collection, i.e. is marked or a root.
+ */
+static bool gc_is_marked(GarbageCollector* gc, void* ptr)
+{
+    GcSlab* s = gc_slab_of(gc->slabs, ptr);
+    if (s) {
+        long i = gc_slab_index(s, ptr);
+        return i >= 0 && (gc_bit_test(s->mark, i) || gc_bit_test(s->root, i));
+    }
+    Allocation* alloc = gc_allocation_map_get(gc->allocs, ptr);
+    return alloc && (alloc->tag & (GC_TAG_MARK | GC_TAG_ROOT));
+}
+
+/**
+ * Drop remembered objects that did not survive a major collection.
+ */
+static void gc_nursery_prune(GarbageCollector* gc)
+{
+    GcNursery* n = gc->nursery;
+    if (!n) return;
+    size_t kept = 0;
+    for (size_t i = 0; i < n->remembered_size; ++i) {
+        if (gc_is_marked(gc, n->remembered[i])) {
+            n->remembered[kept++] = n->remembered[i];
+        }
+    }
+    n->remembered_size = kept;
+}
+
+static void gc_start_ext(GarbageCollector* gc,
+                  void* bos,
+                  size_t initial_capacity,
                   size_t min_capacity,
                   double downsize_load_factor,
                   double upsize_load_factor,
@@ -516,6 +1622,13 @@ static void gc_start_ext(GarbageCollector* gc,
     sweep_factor = sweep_factor > 0.0 ? sweep_factor : 0.5;
     gc->paused = false;
     gc->bos = bos;
+    gc->roots = gc_root_set_new();
+    gc->nursery = gc_nursery_new(GC_NURSERY_SIZE);
+    gc->slabs = gc_slab_heap_new();
+    gc->marking = gc_mark_stack_new();
+    gc->stats = (GcStats*) calloc(1, sizeof(GcStats));
+    gc->stats->start_ns = gc_clock_ns();
+    gc->policy = (GcHeapPolicy*) calloc(1, sizeof(GcHeapPolicy));
     initial_capacity = initial_capacity < min_capacity ? min_capacity : initial_capacity;
     gc->allocs = gc_allocation_map_new(min_capacity, initial_capacity,
                                        sweep_factor, downsize_limit, upsize_limit);
@@ -538,40 +1651,531 @@ static void gc_resume(GarbageCollector* gc)
     gc->paused = false;
 }
 
-static void gc_mark_alloc(GarbageCollector* gc, void* ptr)
+/**
+ * `gc_mark_object` for parallel markers, several of which may race for the
+ * same object.
+ */
+static bool gc_mark_object_atomic(GarbageCollector* gc, GcSlab* s, void* ptr)
 {
+    if (s) {
+        long i = gc_slab_index(s, ptr);
+        if (i < 0) return false;
+        uint64_t bit = (uint64_t) 1 << (i % 64);
+        uint64_t* word = &s->mark[i / 64];
+        if ((__atomic_load_n(word, __ATOMIC_RELAXED) & bit) ||
+                (__atomic_fetch_or(word, bit, __ATOMIC_RELAXED) & bit)) {
+            return false;
+        }
+        gc->marking->marked++;
+        gc->marking->marked_bytes += s->object_size;
+        return true;
+    }
     Allocation* alloc = gc_allocation_map_get(gc->allocs, ptr);
-    /* Mark if alloc exists and is not tagged already, otherwise skip */
-    if (alloc && !(alloc->tag & GC_TAG_MARK)) {
-        LOG_DEBUG("Marking allocation (ptr=%p)", ptr);
-        alloc->tag |= GC_TAG_MARK;
-        /* Iterate over allocation contents and mark them as well */
-        LOG_DEBUG("Checking allocation (ptr=%p, size=%lu) contents", ptr, alloc->size);
-        for (char* p = (char*) alloc->ptr;
-                p <= (char*) alloc->ptr + alloc->size - PTRSIZE;
-                ++p) {
-            LOG_DEBUG("Checking allocation (ptr=%p) @%lu with value %p",
-                      ptr, p-((char*) alloc->ptr), *(void**)p);
-            gc_mark_alloc(gc, *(void**)p);
+    return alloc && !(__atomic_fetch_or(&alloc->tag, GC_TAG_MARK, __ATOMIC_RELAXED) & GC_TAG_MARK);
+}
+
+/**
+ * Mark a single allocation without looking at its contents.
+ *
+ * This is the building block for precise tracing: the caller knows what the
+ * allocation holds and traces its children itself.
+ *
+ * @param gc A pointer to a garbage collector instance.
+ * @param ptr The pointer to mark. Unknown pointers are ignored.
+ * @returns true if the allocation was marked by this call, false if it is
+ *          unknown or was already marked.
+ */
+static bool gc_mark_object(GarbageCollector* gc, void* ptr)
+{
+    GcSlab* s = gc_slab_of(gc->slabs, ptr);
+    if (gc->marking->shared) return gc_mark_object_atomic(gc, s, ptr);
+    if (s) {
+        if (!gc_slab_mark(s, ptr)) return false;
+        gc->slabs->marked++;
+        gc->slabs->marked_bytes += s->object_size;
+        return true;
+    }
+    Allocation* alloc = gc_allocation_map_get(gc->allocs, ptr);
+    if (!alloc || (alloc->tag & GC_TAG_MARK)) return false;
+    LOG_DEBUG("Marking allocation (ptr=%p)", ptr);
+    alloc->tag |= GC_TAG_MARK;
+    return true;
+}
+
+/**
+ * Queue a freshly marked object on the work list.
+ *
+ * The object is prefetched, as it is likely to be scanned soon. If the work
+ * list cannot grow any further the object stays marked but unscanned, and
+ * `gc_mark_step` rescans the heap.
+ */
+static inline void gc_deque_push(GcMarkStack* d, uintptr_t item)
+{
+    int64_t b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+    int64_t t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    if (b - t >= (int64_t) d->capacity) {
+        d->overflowed = true;
+        return;
+    }
+    __atomic_store_n(&d->items[b & (d->capacity - 1)], item, __ATOMIC_RELAXED);
+    __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Take the most recently pushed entry of the own deque, 0 if it is empty.
+ */
+static inline uintptr_t gc_deque_pop(GcMarkStack* d)
+{
+    int64_t b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&d->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t t = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+    if (t > b) {
+        __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    uintptr_t item = __atomic_load_n(&d->items[b & (d->capacity - 1)], __ATOMIC_RELAXED);
+    if (t == b) {
+        /* Last entry, race against thieves for it */
+        if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, false,
+                                         __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            item = 0;
+        }
+        __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+    return item;
+}
+
+/**
+ * Take the oldest entry of another marker's deque, 0 if there is none or
+ * another thread was faster.
+ */
+static inline uintptr_t gc_deque_steal(GcMarkStack* d)
+{
+    int64_t t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+    if (t >= b) return 0;
+    uintptr_t item = __atomic_load_n(&d->items[t & (d->capacity - 1)], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, false,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    return item;
+}
+
+static void gc_mark_push(GarbageCollector* gc, void* ptr, uintptr_t flags)
+{
+    GcMarkStack* ms = gc->marking;
+    if (ms->shared) {
+        GC_PREFETCH(ptr);
+        gc_deque_push(ms, (uintptr_t) ptr | flags);
+        return;
+    }
+    if (ms->size == ms->capacity) {
+        uintptr_t* items = NULL;
+        if (ms->capacity < GC_MARK_STACK_MAX) {
+            items = (uintptr_t*) realloc(ms->items, 2 * ms->capacity * sizeof(uintptr_t));
+        }
+        if (!items) {
+            ms->overflowed = true;
+            return;
+        }
+        ms->items = items;
+        ms->capacity *= 2;
+    }
+    GC_PREFETCH(ptr);
+    ms->items[ms->size++] = (uintptr_t) ptr | flags;
+}
+
+/**
+ * Mark an object whose layout is known to the registered tracer.
+ */
+static inline void gc_mark_traced(GarbageCollector* gc, void* ptr)
+{
+    if (gc_mark_object(gc, ptr)) gc_mark_push(gc, ptr, GC_MARK_PRECISE);
+}
+
+/**
+ * Mark an allocation of unknown layout.
+ *
+ * The allocation is scanned conservatively: every pointer-aligned word is
+ * treated as a potential raw or NaN-boxed pointer. This is only used for
+ * ambiguous roots (the C stack, static allocations), everything reachable
+ * through a `Value` is traced precisely by the root scanners.
+ */
+static inline void gc_mark_alloc(GarbageCollector* gc, void* ptr)
+{
+    if (gc_mark_object(gc, ptr)) gc_mark_push(gc, ptr, 0);
+}
+
+static void gc_set_tracer(GarbageCollector* gc, GcTraceFn trace)
+{
+    gc->marking->trace = trace;
+}
+
+/**
+ * The size of a managed allocation, zero for unknown pointers.
+ */
+static size_t gc_object_size(GarbageCollector* gc, void* ptr)
+{
+    GcSlab* s = gc_slab_of(gc->slabs, ptr);
+    if (s) return s->object_size;
+    Allocation* alloc = gc_allocation_map_get(gc->allocs, ptr);
+    return alloc ? alloc->size : 0;
+}
+
+static void gc_scan_words(GarbageCollector* gc, void* ptr, size_t size)
+{
+    LOG_DEBUG("Checking allocation (ptr=%p, size=%lu) contents", ptr, size);
+    for (char* p = (char*) ptr; p + PTRSIZE <= (char*) ptr + size; p += PTRSIZE) {
+        gc_mark_alloc(gc, (void*) (*(uintptr_t*)p & GC_PAYLOAD_MASK));
+    }
+}
+
+/**
+ * Conservatively rescan every marked object after the work list overflowed.
+ *
+ * Unscanned objects are marked, so their unmarked children can only be found
+ * by scanning all marked objects again. Scanning conservatively is safe for
+ * precisely traced objects as well, it may only retain a little more.
+ */
+static void gc_mark_rescan(GarbageCollector* gc)
+{
+    LOG_DEBUG("Mark stack overflowed, rescanning the heap%s", "");
+    GcSlabHeap* h = gc->slabs;
+    for (char* p = h->start; p < h->top; p += GC_SLAB_SIZE) {
+        GcSlab* s = (GcSlab*) p;
+        if (s->size_class == GC_SLAB_EMPTY) continue;
+        for (size_t i = 0; i < s->capacity; ++i) {
+            if (gc_bit_test(s->mark, i)) gc_scan_words(gc, gc_slab_object(s, i), s->object_size);
+        }
+    }
+    for (size_t i = 0; i < gc->allocs->capacity; ++i) {
+        for (Allocation* chunk = gc->allocs->allocs[i]; chunk; chunk = chunk->next) {
+            if (chunk->tag & GC_TAG_MARK) gc_scan_words(gc, chunk->ptr, chunk->size);
+        }
+    }
+}
+
+static inline void gc_mark_process(GarbageCollector* gc, uintptr_t item)
+{
+    void* ptr = (void*) (item & ~GC_MARK_PRECISE);
+    if ((item & GC_MARK_PRECISE) && gc->marking->trace) {
+        gc->marking->trace(gc, ptr);
+    } else {
+        gc_scan_words(gc, ptr, gc_object_size(gc, ptr));
+    }
+}
+
+static bool gc_mark_pool_has_work(GcMarkPool* pool)
+{
+    for (size_t i = 0; i < pool->size; ++i) {
+        GcMarkStack* d = &pool->workers[i].stack;
+        if (__atomic_load_n(&d->top, __ATOMIC_ACQUIRE) < __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * The marking loop of a parallel marker.
+ *
+ * Drains the own deque, then steals from the others. A marker that finds no
+ * work counts itself as idle; marking is complete once all markers are idle,
+ * since only busy markers push new work.
+ */
+static void gc_mark_work(GcMarkWorker* w)
+{
+    GcMarkPool* pool = w->pool;
+    while (true) {
+        uintptr_t item;
+        while ((item = gc_deque_pop(&w->stack))) {
+            gc_mark_process(&w->gc, item);
+        }
+        for (size_t k = 1; k < pool->size && !item; ++k) {
+            item = gc_deque_steal(&pool->workers[(w->index + k) % pool->size].stack);
+        }
+        if (item) {
+            gc_mark_process(&w->gc, item);
+            continue;
+        }
+        __atomic_add_fetch(&pool->idle, 1, __ATOMIC_SEQ_CST);
+        while (true) {
+            if (__atomic_load_n(&pool->idle, __ATOMIC_SEQ_CST) == pool->size) return;
+            if (gc_mark_pool_has_work(pool)) {
+                __atomic_sub_fetch(&pool->idle, 1, __ATOMIC_SEQ_CST);
+                break;
+            }
+            gc_thread_yield();
+        }
+    }
+}
+
+static void gc_mark_worker_main(GcMarkWorker* w)
+{
+    GcMarkPool* pool = w->pool;
+    uint64_t seen = 0;
+    gc_mutex_lock(&pool->lock);
+    while (true) {
+        while (!pool->shutdown && pool->round == seen) {
+            gc_cond_wait(&pool->start, &pool->lock);
+        }
+        if (pool->shutdown) break;
+        seen = pool->round;
+        gc_mutex_unlock(&pool->lock);
+        gc_mark_work(w);
+        gc_mutex_lock(&pool->lock);
+        if (--pool->running == 0) gc_cond_broadcast(&pool->done);
+    }
+    gc_mutex_unlock(&pool->lock);
+}
+
+#if defined(_WIN32) || defined(_WIN64)
+static DWORD WINAPI gc_mark_thread(LPVOID arg)
+{
+    gc_mark_worker_main((GcMarkWorker*) arg);
+    return 0;
+}
+#else
+static void* gc_mark_thread(void* arg)
+{
+    gc_mark_worker_main((GcMarkWorker*) arg);
+    return NULL;
+}
+#endif
+
+static GcMarkPool* gc_mark_pool_new(size_t size)
+{
+    GcMarkPool* pool = (GcMarkPool*) calloc(1, sizeof(GcMarkPool));
+    pool->workers = (GcMarkWorker*) calloc(size, sizeof(GcMarkWorker));
+    gc_mutex_init(&pool->lock);
+    gc_cond_init(&pool->start);
+    gc_cond_init(&pool->done);
+    for (size_t i = 0; i < size; ++i) {
+        GcMarkWorker* w = &pool->workers[i];
+        w->pool = pool;
+        w->index = i;
+        w->stack.shared = true;
+        w->stack.capacity = GC_MARK_DEQUE_SIZE;
+        w->stack.items = (uintptr_t*) malloc(GC_MARK_DEQUE_SIZE * sizeof(uintptr_t));
+        if (i == 0) continue;
+#if defined(_WIN32) || defined(_WIN64)
+        w->thread = CreateThread(NULL, 0, gc_mark_thread, w, 0, NULL);
+        bool started = w->thread != NULL;
+#else
+        bool started = pthread_create(&w->thread, NULL, gc_mark_thread, w) == 0;
+#endif
+        if (!started) {
+            LOG_WARNING("Failed to start marker thread %zu", i);
+            free(w->stack.items);
+            break;
+        }
+        pool->size = i;
+    }
+    pool->size++;
+    return pool;
+}
+
+static void gc_mark_pool_delete(GcMarkPool* pool)
+{
+    gc_mutex_lock(&pool->lock);
+    pool->shutdown = true;
+    gc_cond_broadcast(&pool->start);
+    gc_mutex_unlock(&pool->lock);
+    for (size_t i = 0; i < pool->size; ++i) {
+        GcMarkWorker* w = &pool->workers[i];
+        if (i > 0) {
+#if defined(_WIN32) || defined(_WIN64)
+            WaitForSingleObject(w->thread, INFINITE);
+            CloseHandle(w->thread);
+#else
+            pthread_join(w->thread, NULL);
+#endif
+        }
+        free(w->stack.items);
+    }
+    gc_cond_destroy(&pool->start);
+    gc_cond_destroy(&pool->done);
+    gc_mutex_destroy(&pool->lock);
+    free(pool->workers);
+    free(pool);
+}
+
+/**
+ * Drain the work list with all markers of the pool.
+ *
+ * The entries queued so far, i.e. the roots, are split into contiguous
+ * slices, one per marker; work stealing balances the rest. Anything the
+ * deques could not hold is left to the serial overflow handling.
+ */
+static void gc_mark_parallel(GarbageCollector* gc)
+{
+    GcMarkStack* ms = gc->marking;
+    GcMarkPool* pool = ms->pool;
+    LOG_DEBUG("Marking in parallel with %zu threads", pool->size);
+    for (size_t i = 0; i < pool->size; ++i) {
+        GcMarkWorker* w = &pool->workers[i];
+        w->gc = *gc;
+        w->gc.marking = &w->stack;
+        w->stack.trace = ms->trace;
+        w->stack.top = w->stack.bottom = 0;
+        w->stack.marked = 0;
+        w->stack.marked_bytes = 0;
+        w->stack.overflowed = false;
+    }
+    for (size_t i = 0; i < ms->size; ++i) {
+        gc_deque_push(&pool->workers[i * pool->size / ms->size].stack, ms->items[i]);
+    }
+    ms->size = 0;
+    pool->idle = 0;
+
+    gc_mutex_lock(&pool->lock);
+    pool->running = pool->size - 1;
+    pool->round++;
+    gc_cond_broadcast(&pool->start);
+    gc_mutex_unlock(&pool->lock);
+
+    gc_mark_work(&pool->workers[0]);
+
+    gc_mutex_lock(&pool->lock);
+    while (pool->running) gc_cond_wait(&pool->done, &pool->lock);
+    gc_mutex_unlock(&pool->lock);
+
+    for (size_t i = 0; i < pool->size; ++i) {
+        gc->slabs->marked += pool->workers[i].stack.marked;
+        gc->slabs->marked_bytes += pool->workers[i].stack.marked_bytes;
+        ms->overflowed |= pool->workers[i].stack.overflowed;
+    }
+}
+
+/**
+ * Process the work list until every reachable object has been scanned, or
+ * until `deadline` (as returned by `gc_clock_ns`) has passed.
+ *
+ * The time spent is proportional to the number of live objects, independent
+ * of how deeply they are nested. A deadline of 0 runs to completion, on
+ * all parallel markers if there are any; slices with a deadline are short
+ * and always run on the calling thread.
+ *
+ * @returns true if marking is complete.
+ */
+static bool gc_mark_step(GarbageCollector* gc, uint64_t deadline)
+{
+    GcMarkStack* ms = gc->marking;
+    uint64_t start = gc_clock_ns();
+    size_t work = 0;
+    bool done = false;
+    if (!deadline && ms->pool) gc_mark_parallel(gc);
+    while (!done) {
+        while (ms->size) {
+            if (deadline && ++work % GC_MARK_CHECK == 0 && gc_clock_ns() >= deadline) {
+                gc->stats->mark_ns += gc_clock_ns() - start;
+                return false;
+            }
+            gc_mark_process(gc, ms->items[--ms->size]);
+        }
+        done = !ms->overflowed;
+        if (ms->overflowed) {
+            ms->overflowed = false;
+            gc_mark_rescan(gc);
+        }
+    }
+    gc->stats->mark_ns += gc_clock_ns() - start;
+    return true;
+}
+
+static void gc_set_pause_target(GarbageCollector* gc, double ms)
+{
+    gc->marking->pause_ns = ms > 0.0 ? (uint64_t) (ms * 1e6) : 0;
+}
+
+static size_t gc_cpu_count(void)
+{
+#if defined(_WIN32) || defined(_WIN64)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (size_t) n : 1;
+#endif
+}
+
+/**
+ * Set the number of threads used for stop-the-world marking, including the
+ * collecting thread. 0 or 1 marks serially. More markers than CPUs would
+ * only contend, so the count is capped at the number of online CPUs.
+ */
+static void gc_set_mark_threads(GarbageCollector* gc, size_t threads)
+{
+    GcMarkStack* ms = gc->marking;
+    size_t cpus = gc_cpu_count();
+    if (threads > cpus) threads = cpus;
+    if (ms->pool) gc_mark_pool_delete(ms->pool);
+    ms->pool = threads > 1 ? gc_mark_pool_new(threads) : NULL;
+}
+
+/**
+ * Size the heap in bytes: collect once it grows past `initial_bytes`, then
+ * past `growth_factor` times what survived the last collection. A non-zero
+ * `max_bytes` is a hard limit, allocations that do not fit under it even
+ * after a full collection terminate the program. Minor collections count
+ * the whole young generation against it, as all of it may be promoted.
+ */
+static void gc_set_heap_policy(GarbageCollector* gc, size_t initial_bytes, size_t max_bytes,
+                               double growth_factor)
+{
+    GcHeapPolicy* p = gc->policy;
+    if (max_bytes && initial_bytes > max_bytes) initial_bytes = max_bytes;
+    p->initial_bytes = initial_bytes;
+    p->max_bytes = max_bytes;
+    p->growth_factor = growth_factor > 1.0 ? growth_factor : 2.0;
+    gc_heap_policy_update(p, gc_heap_bytes(gc));
+}
+
+static void gc_add_root(GarbageCollector* gc, GcRootFn mark, void* ctx)
+{
+    GcRootSet* rs = gc->roots;
+    if (rs->size == rs->capacity) {
+        rs->capacity *= 2;
+        rs->roots = (GcRoot*) realloc(rs->roots, rs->capacity * sizeof(GcRoot));
+    }
+    rs->roots[rs->size++] = (GcRoot) { mark, ctx };
+}
+
+static void gc_remove_root(GarbageCollector* gc, GcRootFn mark, void* ctx)
+{
+    GcRootSet* rs = gc->roots;
+    for (size_t i = 0; i < rs->size; ++i) {
+        if (rs->roots[i].mark == mark && rs->roots[i].ctx == ctx) {
+            rs->roots[i] = rs->roots[--rs->size];
+            return;
         }
     }
 }
 
 static void gc_mark_stack(GarbageCollector* gc)
 {
-    LOG_DEBUG("Marking the stack (gc@%p) in increments of %ld", (void*) gc, sizeof(char));
+    LOG_DEBUG("Marking the stack (gc@%p) in increments of %ld", (void*) gc, PTRSIZE);
     void *tos = __builtin_frame_address(0);
     void *bos = gc->bos;
     /* The stack grows towards smaller memory addresses, hence we scan tos->bos.
-     * Stop scanning once the distance between tos & bos is too small to hold a valid pointer */
-    for (char* p = (char*) tos; p <= (char*) bos - PTRSIZE; ++p) {
-        gc_mark_alloc(gc, *(void**)p);
+     * Stack slots are pointer-aligned, so only aligned words can hold a pointer. */
+    char* p = (char*) ((uintptr_t) tos & ~(uintptr_t) (PTRSIZE - 1));
+    for (; p <= (char*) bos - PTRSIZE; p += PTRSIZE) {
+        gc_mark_alloc(gc, (void*) (*(uintptr_t*)p & GC_PAYLOAD_MASK));
     }
 }
 
 static void gc_mark_roots(GarbageCollector* gc)
 {
     LOG_DEBUG("Marking roots%s", "");
+    GcRootSet* rs = gc->roots;
+    for (size_t i = 0; i < rs->size; ++i) {
+        rs->roots[i].mark(gc, rs->roots[i].ctx);
+    }
     for (size_t i = 0; i < gc->allocs->capacity; ++i) {
         Allocation* chunk = gc->allocs->allocs[i];
         while (chunk) {
@@ -582,26 +2186,79 @@ static void gc_mark_roots(GarbageCollector* gc)
             chunk = chunk->next;
         }
     }
+    GcSlabHeap* h = gc->slabs;
+    for (char* p = h->start; p < h->top; p += GC_SLAB_SIZE) {
+        GcSlab* s = (GcSlab*) p;
+        if (s->size_class == GC_SLAB_EMPTY) continue;
+        for (size_t i = 0; i < s->capacity; ++i) {
+            if (gc_bit_test(s->root, i)) gc_mark_alloc(gc, gc_slab_object(s, i));
+        }
+    }
 }
 
-static void gc_mark(GarbageCollector* gc)
+/**
+ * Start a mark cycle by marking everything directly reachable from the roots.
+ *
+ * This takes the snapshot that the cycle traces: until `gc_sweep`, new
+ * allocations are marked on creation and stores must mark the reference they
+ * overwrite, so that everything reachable at this point survives.
+ */
+static void gc_mark_begin(GarbageCollector* gc)
 {
     /* Note: We only look at the stack and the heap, and ignore BSS. */
     LOG_DEBUG("Initiating GC mark (gc@%p)", (void*) gc);
-    /* Scan the heap for roots */
+    uint64_t start = gc_clock_ns();
+    gc->marking->active = true;
+    /* Marks of the previous cycle must be gone before setting new ones */
+    gc_slab_sweep_pending(gc->slabs);
+    /* Trace the registered roots precisely, then the static allocations */
     gc_mark_roots(gc);
-    /* Dump registers onto stack and scan the stack */
+    /* Dump registers onto stack and scan the stack for in-flight temporaries */
     void (*volatile _mark_stack)(GarbageCollector*) = gc_mark_stack;
     jmp_buf ctx;
     memset(&ctx, 0, sizeof(jmp_buf));
     (void) setjmp(ctx);
     _mark_stack(gc);
+    gc->stats->mark_ns += gc_clock_ns() - start;
+}
+
+static void gc_mark(GarbageCollector* gc)
+{
+    if (!gc_marking(gc)) gc_mark_begin(gc);
+    gc_mark_step(gc, 0);
+}
+
+/**
+ * Drop the marks of an unfinished cycle.
+ */
+static void gc_mark_abort(GarbageCollector* gc)
+{
+    GcMarkStack* ms = gc->marking;
+    if (!ms->active) return;
+    ms->active = false;
+    ms->size = 0;
+    ms->overflowed = false;
+    GcSlabHeap* h = gc->slabs;
+    h->marked = 0;
+    h->marked_bytes = 0;
+    for (char* p = h->start; p < h->top; p += GC_SLAB_SIZE) {
+        memset(((GcSlab*) p)->mark, 0, sizeof(((GcSlab*) p)->mark));
+    }
+    for (size_t i = 0; i < gc->allocs->capacity; ++i) {
+        for (Allocation* chunk = gc->allocs->allocs[i]; chunk; chunk = chunk->next) {
+            chunk->tag &= ~GC_TAG_MARK;
+        }
+    }
 }
 
 static size_t gc_sweep(GarbageCollector* gc)
 {
     LOG_DEBUG("Initiating GC sweep (gc@%p)", (void*) gc);
+    uint64_t start = gc_clock_ns();
+    gc->marking->active = false;
     size_t total = 0;
+    size_t freed = 0;
+    size_t kept = 0;
     for (size_t i = 0; i < gc->allocs->capacity; ++i) {
         Allocation* chunk = gc->allocs->allocs[i];
         Allocation* next = NULL;
@@ -611,11 +2268,13 @@ static size_t gc_sweep(GarbageCollector* gc)
                 LOG_DEBUG("Found used allocation %p (ptr=%p)", (void*) chunk, (void*) chunk->ptr);
                 /* unmark */
                 chunk->tag &= ~GC_TAG_MARK;
+                kept += chunk->size;
                 chunk = chunk->next;
             } else {
                 LOG_DEBUG("Found unused allocation %p (%lu bytes @ ptr=%p)", (void*) chunk, chunk->size, (void*) chunk->ptr);
                 /* no reference to this chunk, hence delete it */
                 total += chunk->size;
+                freed++;
                 if (chunk->dtor) {
                     chunk->dtor(chunk->ptr);
                 }
@@ -627,7 +2286,17 @@ static size_t gc_sweep(GarbageCollector* gc)
             }
         }
     }
+    GcStats* st = gc->stats;
+    st->live_bytes = kept + gc->slabs->marked_bytes;
+    gc_slab_sweep_begin(gc->slabs);
     gc_allocation_map_resize_to_fit(gc->allocs);
+    gc_allocation_map_update_sweep_limit(gc->allocs, gc_live_objects(gc));
+    gc_heap_policy_update(gc->policy, gc_heap_bytes(gc));
+    st->collections++;
+    st->live_objects = gc_live_objects(gc);
+    st->bytes_freed += total;
+    st->objects_freed += freed;
+    st->sweep_ns += gc_clock_ns() - start;
     return total;
 }
 
@@ -648,13 +2317,26 @@ static void gc_unroot_roots(GarbageCollector* gc)
             chunk = chunk->next;
         }
     }
+    GcSlabHeap* h = gc->slabs;
+    for (char* p = h->start; p < h->top; p += GC_SLAB_SIZE) {
+        memset(((GcSlab*) p)->root, 0, sizeof(((GcSlab*) p)->root));
+    }
 }
 
 static size_t gc_stop(GarbageCollector* gc)
 {
+    gc_mark_abort(gc);
+    gc_slab_sweep_pending(gc->slabs);
     gc_unroot_roots(gc);
     size_t collected = gc_sweep(gc);
+    collected += gc_slab_sweep_pending(gc->slabs);
     gc_allocation_map_delete(gc->allocs);
+    gc_root_set_delete(gc->roots);
+    gc_nursery_delete(gc->nursery);
+    gc_slab_heap_delete(gc->slabs);
+    gc_mark_stack_delete(gc->marking);
+    free(gc->stats);
+    free(gc->policy);
     return collected;
 }
 
@@ -662,9 +2344,47 @@ static inline size_t gc_run(GarbageCollector* gc)
 {
     LOG_DEBUG("Initiating GC run (gc@%p)", (void*) gc);
     gc_mark(gc);
+    gc_nursery_prune(gc);
     return gc_sweep(gc);
 }
 
+/**
+ * The collection policy, applied on allocation.
+ *
+ * Without a pause target a full collection runs once the heap policy says
+ * one is due. With one, that starts an incremental cycle, and every
+ * GC_MARK_STRIDE allocations a slice marks for at most the target pause. The
+ * cycle is finished in one go if the heap grows past twice its limit before
+ * marking completes.
+ *
+ * @returns The number of bytes freed.
+ */
+static size_t gc_collect(GarbageCollector* gc)
+{
+    GcMarkStack* ms = gc->marking;
+    if (gc->paused) return 0;
+    if (!ms->active && !gc_needs_sweep(gc)) return 0;
+    if (ms->active && ms->countdown > 0 && !gc_sweep_overdue(gc)) {
+        ms->countdown--;
+        return 0;
+    }
+    uint64_t start = gc_clock_ns();
+    size_t freed = 0;
+    if (!ms->active && !ms->pause_ns) {
+        freed = gc_run(gc);
+    } else {
+        if (!ms->active) gc_mark_begin(gc);
+        ms->countdown = GC_MARK_STRIDE;
+        uint64_t deadline = gc_sweep_overdue(gc) ? 0 : start + ms->pause_ns;
+        if (gc_mark_step(gc, deadline)) {
+            gc_nursery_prune(gc);
+            freed = gc_sweep(gc);
+        }
+    }
+    gc_stats_pause(gc->stats, gc_clock_ns() - start);
+    return freed;
+}
+
 static char* gc_strdup (GarbageCollector* gc, const char* s)
 {
     size_t len = strlen(s) + 1;
@@ -676,5 +2396,89 @@ static char* gc_strdup (GarbageCollector* gc, const char* s)
     return (char*) memcpy(new, s, len);
 }
 
+/**
+ * Take a snapshot of the collector statistics.
+ */
+static void gc_get_stats(GarbageCollector* gc, GcStats* out)
+{
+    GcSlabHeap* h = gc->slabs;
+    *out = *gc->stats;
+    out->sweep_ns += h->sweep_ns;
+    out->bytes_freed += h->freed_bytes;
+    out->objects_freed += h->freed_objects;
+    out->bytes_allocated += gc->nursery->top - gc->nursery->start;
+    out->heap_objects = gc_live_objects(gc);
+    out->heap_bytes = gc_heap_bytes(gc);
+    out->load_factor = gc_allocation_map_load_factor(gc->allocs);
+}
+
+/**
+ * Format the collector statistics as a JSON object.
+ *
+ * Behaves like `snprintf`: writes at most `size` bytes to `buf` and returns
+ * the length of the complete output.
+ */
+static int gc_stats_format(GarbageCollector* gc, char* buf, size_t size)
+{
+    GcStats st;
+    gc_get_stats(gc, &st);
+    double elapsed = (gc_clock_ns() - st.start_ns) / 1e9;
+    size_t len = 0;
+#define GC_STATS_PRINT(...) \
+    len += snprintf(len < size ? buf + len : NULL, len < size ? size - len : 0, __VA_ARGS__)
+    GC_STATS_PRINT("{\n");
+    GC_STATS_PRINT("  \"elapsed_ms\": %.3f,\n", elapsed * 1e3);
+    GC_STATS_PRINT("  \"collections\": %zu,\n", st.collections);
+    GC_STATS_PRINT("  \"minor_collections\": %zu,\n", st.minor_collections);
+    GC_STATS_PRINT("  \"mark_ms\": %.3f,\n", st.mark_ns / 1e6);
+    GC_STATS_PRINT("  \"sweep_ms\": %.3f,\n", st.sweep_ns / 1e6);
+    GC_STATS_PRINT("  \"minor_ms\": %.3f,\n", st.minor_ns / 1e6);
+    GC_STATS_PRINT("  \"pauses\": %zu,\n", st.pauses);
+    GC_STATS_PRINT("  \"pause_total_ms\": %.3f,\n", st.pause_total_ns / 1e6);
+    GC_STATS_PRINT("  \"pause_max_ms\": %.3f,\n", st.pause_max_ns / 1e6);
+    GC_STATS_PRINT("  \"pause_histogram\": [");
+    const char* sep = "";
+    for (size_t i = 0; i < GC_PAUSE_BUCKETS; ++i) {
+        if (!st.pause_histogram[i]) continue;
+        if (i == GC_PAUSE_BUCKETS - 1) {
+            GC_STATS_PRINT("%s{\"above_us\": %llu, \"count\": %zu}", sep,
+                           1ull << i, st.pause_histogram[i]);
+        } else {
+            GC_STATS_PRINT("%s{\"below_us\": %llu, \"count\": %zu}", sep,
+                           1ull << (i + 1), st.pause_histogram[i]);
+        }
+        sep = ", ";
+    }
+    GC_STATS_PRINT("],\n");
+    GC_STATS_PRINT("  \"bytes_allocated\": %zu,\n", st.bytes_allocated);
+    GC_STATS_PRINT("  \"allocation_rate_mb_s\": %.3f,\n",
+                   elapsed > 0 ? st.bytes_allocated / elapsed / 1e6 : 0.0);
+    GC_STATS_PRINT("  \"bytes_promoted\": %zu,\n", st.bytes_promoted);
+    GC_STATS_PRINT("  \"bytes_freed\": %zu,\n", st.bytes_freed);
+    GC_STATS_PRINT("  \"objects_freed\": %zu,\n", st.objects_freed);
+    GC_STATS_PRINT("  \"live_bytes\": %zu,\n", st.live_bytes);
+    GC_STATS_PRINT("  \"live_objects\": %zu,\n", st.live_objects);
+    GC_STATS_PRINT("  \"heap_objects\": %zu,\n", st.heap_objects);
+    GC_STATS_PRINT("  \"heap_bytes\": %zu,\n", st.heap_bytes);
+    GC_STATS_PRINT("  \"allocation_map_load_factor\": %.4f\n", st.load_factor);
+    GC_STATS_PRINT("}\n");
+#undef GC_STATS_PRINT
+    return (int) len;
+}
+
+/**
+ * Write the collector statistics as JSON to the file at `path`.
+ */
+static bool gc_stats_write(GarbageCollector* gc, const char* path)
+{
+    int len = gc_stats_format(gc, NULL, 0);
+    char* buf = (char*) malloc(len + 1);
+    gc_stats_format(gc, buf, len + 1);
+    FILE* file = fopen(path, "w");
+    bool ok = file && fwrite(buf, 1, len, file) == (size_t) len;
+    if (file) ok = fclose(file) == 0 && ok;
+    free(buf);
+    return ok;
+}
 
 #endif /* !__GC_H__ */
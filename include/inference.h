@@ -0,0 +1,12 @@
+#ifndef INFERENCE_H
+#define INFERENCE_H
+
+#include <module.h>
+
+// Infers the types of locals and stack slots in each function body, and
+// rewrites the arithmetic and comparisons whose operands are proven integers
+// to their integer variants, which do not check tags. Only valid on verified
+// modules, and must run before `fuse_superinstructions`.
+void specialize_integers(Deserialized *module);
+
+#endif  // INFERENCE_H
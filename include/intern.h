@@ -0,0 +1,16 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <value.h>
+
+// The string constants of all modules are interned as they are loaded: the
+// first string with a given content is kept in a table shared by the VM,
+// and later ones are replaced by it. Interned strings are marked in their
+// header, so that two of them compare by identity (see string_equal).
+//
+// Strings built at run time are not interned. Young strings, which may
+// still move, are returned as they are. The table does not keep strings
+// alive, only constants are interned and modules keep their constants.
+HeapValue *intern_string(GarbageCollector *gc, HeapValue *string);
+
+#endif  // INTERN_H
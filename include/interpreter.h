@@ -3,8 +3,61 @@
 
 #include <module.h>
 
+// Build with TAIL_CALL_INTERPRETER=1 (`xmake f --tail-call-interpreter=y`)
+// to run bytecode on the tail-calling interpreter instead of the
+// computed-goto loop. Both are always compiled, so that they can be
+// compared in one binary.
+#ifndef TAIL_CALL_INTERPRETER
+#define TAIL_CALL_INTERPRETER 0
+#endif
+
 Value call_function(Deserialized *mod, Value callee, int32_t argc, Value* argv);
 Value call_threaded(Deserialized *mod, Value callee, int32_t argc, Value* argv);
 Value run_interpreter(Deserialized *deserialized, int32_t ipc, bool does_return, int32_t current_callstack);
+Value run_interpreter_loop(Deserialized *deserialized, int32_t ipc, bool does_return, int32_t current_callstack);
+Value run_interpreter_tail(Deserialized *deserialized, int32_t ipc, bool does_return, int32_t current_callstack);
+
+// Shared by both interpreters
+extern int halt;
+
+typedef Value (*ComparisonFun)(Value, Value);
+extern ComparisonFun comparison_table[];
+
+Value compare_eq(Value a, Value b);
+
+// Whether `cmp` indexes a function of comparison_table, which has no entry
+// for Or.
+static inline bool valid_comparison(int32_t cmp) {
+  return cmp >= 0 && cmp < Or && comparison_table[cmp] != NULL;
+}
+
+// Native calls in two steps, so that call sites can cache the first one.
+// `resolve_native` pops the library and function indices below the callee,
+// `invoke_native` replaces the `argc` arguments on the stack by the result.
+Native resolve_native(Deserialized *module, Value callee);
+void invoke_native(Deserialized *module, Native native, int32_t argc);
+
+// Locals of a new frame past its arguments start out unit: minor
+// collections scan the stack up to its top, and must not find young
+// pointers left there by earlier frames.
+static inline void clear_locals(Value *locals, int32_t count) {
+  for (int32_t i = 0; i < count; i++) locals[i] = MAKE_SPECIAL();
+}
+
+// Integer payloads compare unsigned, as in IJumpElseRelCmpConst, so that
+// fused and translated forms of it branch the same way.
+static inline uint32_t icompare(Comparison cmp, uint32_t a, uint32_t b) {
+  switch (cmp) {
+    case LessThan: return a < b;
+    case GreaterThan: return a > b;
+    case EqualTo: return a == b;
+    case NotEqualTo: return a != b;
+    case LessThanOrEqualTo: return a <= b;
+    case GreaterThanOrEqualTo: return a >= b;
+    case And: return a & b;
+    case Or: return a | b;
+  }
+  return 0;
+}
 
-#endif  // INTERPRETER_H
\ No newline at end of file
+#endif  // INTERPRETER_H
@@ -0,0 +1,75 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <module.h>
+
+// A baseline JIT for Linux x86-64. Functions called more than
+// `jit_threshold` times are compiled by copying a machine-code template for
+// each of their instructions. The compiled code runs on the VM stack and
+// returns to the interpreter at the first instruction it has no template for
+// (calls, returns, allocations...) or whose operands are not of the expected
+// type. The interpreters enter it after calls and returns.
+//
+// Left out unless built with -DJIT=1 (the xmake option "jit"), and on
+// other platforms.
+#ifndef JIT
+#define JIT 0
+#endif
+#if JIT && !(defined(__x86_64__) && defined(__linux__))
+#undef JIT
+#define JIT 0
+#endif
+
+#if JIT
+
+// Where the interpreter resumes: the program counter of the instruction
+// compiled code could not run, and the stack pointer.
+typedef struct {
+  int32_t pc;
+  Value *sp;
+} JitExit;
+
+// Prologue of a compiled function, continuing at `code`
+typedef JitExit (*JitCode)(Value *values, Value *sp, Value *locals, Constants constants, void *code);
+
+typedef struct {
+  JitCode enter;
+  void *code;  // machine code of the instruction, NULL if not compiled
+} JitEntry;
+
+// Memory mapped for the code of a function, at its start
+typedef struct JitRegion {
+  struct JitRegion *next;
+  size_t size;
+} JitRegion;
+
+// Per instruction of a module
+typedef struct Jit {
+  uint32_t *calls;     // calls to the function starting at the instruction
+  JitEntry *entries;
+  JitRegion *regions;  // of all compiled functions
+} Jit;
+
+// Number of calls after which a function is compiled, 0 to never compile
+extern uint32_t jit_threshold;
+
+Jit *jit_new(Deserialized *module);
+void jit_compile(Deserialized *module, int32_t ipc);
+
+// Unmaps the compiled code of a module, which must not be running
+void jit_free(Deserialized *module);
+
+static inline void jit_count_call(Deserialized *module, int32_t ipc) {
+  if (++module->jit->calls[ipc >> 2] == jit_threshold) jit_compile(module, ipc);
+}
+
+// Runs compiled code from `pc` if there is any
+static inline JitExit jit_run(Jit *jit, int32_t pc, Value *values, Value *sp, int32_t bp, Constants constants) {
+  JitEntry *entry = &jit->entries[pc >> 2];
+  if (entry->code == NULL) return (JitExit) { pc, sp };
+  return entry->enter(values, sp, values + bp, constants, entry->code);
+}
+
+#endif  // JIT
+
+#endif  // JIT_H
@@ -9,19 +9,40 @@
 
 typedef Value *Constants;
 
+// An instruction of the direct-threaded code: the address of its handler in
+// `run_interpreter` followed by its operands.
 typedef struct {
+  void *handler;
+  int32_t operands[3];
+} ThreadedInstruction;
+
+struct Deserialized;
+
+// A function of a native library
+typedef Value (*Native)(int argc, struct Deserialized *m, Value *args);
+
+typedef struct Deserialized {
   Libraries libraries;
   
   int32_t instr_count;
   int32_t *instrs;
+  ThreadedInstruction *threaded;
+  struct TailInstruction *tail_code;  // threaded code of the tail-calling interpreter
+  struct Jit *jit;                    // call counts and compiled code, see jit.h
+  bool verified;                      // passed verify_module, see verifier.h
+  struct CallCache *call_caches;      // per instruction, see CallCache
+  struct Registers *registers;        // register code, see registers.h
+  struct Switch **switches;           // tables of Switch instructions, see switches.h
+  int32_t switch_count;
 
   int32_t base_pointer;
   int32_t callstack;
 
+  int32_t constant_count;
   Constants constants;
   Stack *stack;
   struct {
-    Value (**functions)(int argc, struct Deserialized *des, Value *args);
+    Native *functions;
   } *natives;
   DLL* handles;
 
@@ -34,8 +55,18 @@ typedef struct {
   Value (*call_threaded)(struct Deserialized *m, Value callee, int32_t argc, Value* argv);
 } Deserialized;
 
-typedef Value (*Native)(int argc, struct Deserialized *m, Value *args);
+// Inline cache of a call site. Calls in verified modules remember the
+// callee they first ran, and their threaded handler is rewritten to one
+// that only compares the callee with it. A native is cached resolved.
+typedef struct CallCache {
+  Value callee;
+  Native native;  // NULL for bytecode functions
+} CallCache;
 
 typedef Deserialized Module;
 
+void module_mark_roots(GarbageCollector *gc, void *module);
+void module_scavenge(GarbageCollector *gc, void *module);
+void nursery_mark_roots(GarbageCollector *gc, void *ctx);
+
 #endif  // MODULE_H
\ No newline at end of file
@@ -0,0 +1,16 @@
+#ifndef NATIVES_H
+#define NATIVES_H
+
+#include <module.h>
+
+// Natives the VM provides itself, for the functions no loaded library
+// defines. Any library may declare them, they are looked up by name after
+// the library's own symbols.
+//
+//   gc_stats()  A list of the collector statistics, see GcStats: major and
+//               minor collections, and pauses, as integers, then total and
+//               longest pause in milliseconds, and bytes allocated,
+//               promoted, freed and in the heap, as floats.
+Native builtin_native(const char *name);
+
+#endif  // NATIVES_H
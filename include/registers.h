@@ -0,0 +1,45 @@
+#ifndef REGISTERS_H
+#define REGISTERS_H
+
+#include <module.h>
+
+// A register tier. At load, the function bodies of verified modules are
+// translated from the stack bytecode into three-address instructions that
+// name locals and operand stack slots directly, which `registers_run`
+// interprets. The interpreters enter it at the same points as compiled code,
+// and it returns to them at the first instruction it has no register form
+// for (calls, returns, allocations...). The bytecode is left unchanged.
+//
+// Build with REGISTER_TIER=1 (`xmake f --register-tier=y`) to use it.
+#ifndef REGISTER_TIER
+#define REGISTER_TIER 0
+#endif
+
+typedef struct RegisterInstruction RegisterInstruction;
+
+typedef struct Registers {
+  RegisterInstruction *code;
+  int32_t *entries;  // per instruction, where register code runs it from, -1 if it does not
+} Registers;
+
+// Where the interpreter resumes: the program counter of the instruction
+// register code could not run, and the stack pointer.
+typedef struct {
+  int32_t pc;
+  Value *sp;
+} RegisterExit;
+
+// Only valid on verified modules, and must run before
+// `fuse_superinstructions`.
+void translate_registers(Deserialized *module);
+
+RegisterExit registers_run(Deserialized *module, int32_t entry, int32_t bp);
+
+// Runs register code from `pc` if there is any
+static inline RegisterExit registers_enter(Deserialized *module, int32_t pc, Value *sp, int32_t bp) {
+  Registers *registers = module->registers;
+  if (registers == NULL || registers->entries[pc >> 2] < 0) return (RegisterExit) { pc, sp };
+  return registers_run(module, registers->entries[pc >> 2], bp);
+}
+
+#endif  // REGISTERS_H
@@ -0,0 +1,8 @@
+#ifndef SUPERINSTRUCTIONS_H
+#define SUPERINSTRUCTIONS_H
+
+#include <stdint.h>
+
+void fuse_superinstructions(int32_t *instrs, int32_t instr_count);
+
+#endif  // SUPERINSTRUCTIONS_H
@@ -0,0 +1,81 @@
+#ifndef SWITCHES_H
+#define SWITCHES_H
+
+#include <module.h>
+
+// A Switch instruction jumps to one of many arms by the value on top of the
+// stack, an integer or a constructor name, in place of a chain of
+// JumpElseRelCmpConst. In the bytecode,
+//
+//   Switch table, default
+//
+// where constants[table] is the number of arms n, followed by n pairs of
+// constants: the key of an arm, then its jump offset. Keys are all integers
+// or all strings, and the first arm of a key wins. Values matching no key
+// jump by `default`.
+//
+// At load, the arms are sorted into a table, indexed by key when the keys
+// are dense and searched by halves otherwise. Names are looked up by their
+// tag (see constructors.h); names built at run time have none and are
+// compared with each key. The third operand of the instruction, unused in
+// the bytecode, is set to the index of its table in `module->switches`.
+
+typedef struct Switch {
+  ValueType type;     // of the keys
+  int32_t otherwise;  // jump offset when no key matches
+  int32_t count;      // of distinct keys
+  int32_t *keys;      // sorted, integers or tags of names
+  int32_t *offsets;   // of the arm of each key
+  int32_t *names;     // constant of each key, for untagged names
+  int32_t min, span;  // of the keys
+  int32_t *dense;     // offsets by key - min, NULL if the keys are sparse
+} Switch;
+
+// Must run after `tag_constructors`, and before `verify_module`. Throws on
+// malformed tables, which no interpreter could run.
+void build_switches(Deserialized *module);
+
+int32_t switch_untagged(Deserialized *module, Switch *s, Value name);
+
+// For code jumping through a table of its own: the slot of `value`, which
+// must be of the type of the keys, among `switch_slots(s)`. Slots are by
+// key - min when the keys are dense and by arm otherwise, the last one is
+// for values matching no key. `switch_slot_offset` is the jump offset of a
+// slot.
+int32_t switch_slot(Deserialized *module, Switch *s, Value value);
+
+static inline int32_t switch_slots(Switch *s) {
+  return (s->dense != NULL ? s->span : s->count) + 1;
+}
+
+static inline int32_t switch_slot_offset(Switch *s, int32_t slot) {
+  if (slot == switch_slots(s) - 1) return s->otherwise;
+  return s->dense != NULL ? s->dense[slot] : s->offsets[slot];
+}
+
+// Jump offset of the arm `value` matches, which must be of the type of the
+// keys
+static inline int32_t switch_offset(Deserialized *module, Switch *s, Value value) {
+  int32_t key;
+  if (s->type == TYPE_STRING) {
+    key = (int32_t) GET_PTR(value)->tag;
+    if (key == 0) return switch_untagged(module, s, value);
+  } else {
+    key = (int32_t) GET_INT(value);
+  }
+
+  if (s->dense != NULL) {
+    uint32_t k = (uint32_t) key - (uint32_t) s->min;
+    return k < (uint32_t) s->span ? s->dense[k] : s->otherwise;
+  }
+
+  int32_t low = 0, high = s->count;
+  while (low < high) {
+    int32_t mid = low + (high - low) / 2;
+    if (s->keys[mid] < key) low = mid + 1;
+    else high = mid;
+  }
+  return low < s->count && s->keys[low] == key ? s->offsets[low] : s->otherwise;
+}
+
+#endif  // SWITCHES_H
@@ -1,7 +1,9 @@
 #ifndef VALUE_H
 #define VALUE_H
 
+#include "core/error.h"
 #include "core/gc.h"
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -78,20 +80,48 @@ typedef struct {
   uint32_t length;
 } String;
 
-// Container type for values
+// Container type for values. Lists, mutables and strings store their
+// payload inline right after the header, in a single allocation, except for
+// list views, which share the elements of the list they were sliced from.
+// Lists of integers built by MakeList are packed with PACKED_INT_LISTS, see
+// HEAP_INTS.
 typedef struct {
   ValueType type;
   uint32_t length;
   uint8_t refcount;
+  uint8_t flags;     // HEAP_INTERNED, HEAP_VIEW or HEAP_INTS
+  uint16_t hash;     // strings: of the content, 0 until computed, see string_hash
+  union {
+    uint32_t tag;     // strings: of a constructor name, 0 if none, see constructors.h
+    uint32_t offset;  // views: of the first element in the viewed list
+  };
 
   union {
-    char* as_string;
-    Value* as_ptr;
+    char as_string[0];
+    Value as_ptr[0];
     void* as_any;
     thread_t as_thread;
   };
 } HeapValue;
 
+// A string that is the only interned one with its content, see intern.h
+#define HEAP_INTERNED 1
+// A list whose payload is the list it views, never a view itself, see
+// MAKE_SLICE
+#define HEAP_VIEW 2
+// A list of integers, stored as int32_t[]. See list_element and list_ints.
+#define HEAP_INTS 4
+
+// Natives that read lists through GET_LIST cannot read lists of integers,
+// so MakeList only builds them with PACKED_INT_LISTS=1
+// (`xmake f --packed-int-lists=y`), once natives use list_element or
+// list_ints.
+#ifndef PACKED_INT_LISTS
+#define PACKED_INT_LISTS 0
+#endif
+
+#define HEAP_VALUE_SIZE(payload) (offsetof(HeapValue, as_ptr) + (payload))
+
 #define MAKE_INTEGER(x) (SIGNATURE_INTEGER | (uint32_t) (x))
 #define MAKE_FLOAT(x) (*(Value*)(&(x)))
 #define MAKE_PTR(x) ( SIGNATURE_POINTER | (uint64_t) (x))
@@ -101,30 +131,124 @@ typedef Value Closure[2];
 #define MAKE_FUNCTION(x, y) (SIGNATURE_FUNCTION | (uint16_t) (x) | ((uint16_t) (y) << 16))
 #define MAKE_FUNCENV(pc, sp, bp) (SIGNATURE_FUNCENV | (uint64_t) (pc) | ((uint64_t) (sp) << 16) | ((uint64_t) (bp) << 32))
 
-static inline Value MAKE_STRING(GarbageCollector gc, char* x) {
-  HeapValue* v = gc_malloc(&gc, sizeof(HeapValue));
-  v->length = strlen(x);
-  v->type = TYPE_STRING;
-  v->as_string = x;
+// Kinds of objects allocated in the nursery
+#define KIND_HEAPVALUE 1
+
+static inline HeapValue* ALLOC_HEAP_VALUE(GarbageCollector gc, ValueType type, uint32_t len, size_t payload) {
+  HeapValue* v = gc_malloc_young(&gc, HEAP_VALUE_SIZE(payload), KIND_HEAPVALUE);
+  v->length = len;
+  v->type = type;
   v->refcount = 0;
+  v->flags = 0;
+  v->hash = 0;
+  v->tag = 0;
+  return v;
+}
+
+// Values stored in the payload of a list or mutable
+static inline uint32_t heap_fields(HeapValue* v) {
+  if (v->flags & HEAP_INTS) return 0;
+  return v->flags & HEAP_VIEW ? 1 : v->length;
+}
+
+// The list a view shares its elements with, and where they start in it
+static inline HeapValue* list_storage(HeapValue* l, uint32_t* offset) {
+  *offset = 0;
+  if (!(l->flags & HEAP_VIEW)) return l;
+  *offset = l->offset;
+  return (HeapValue*) (l->as_ptr[0] & MASK_PAYLOAD_PTR);
+}
+
+// Elements of a list, wherever they are stored. Lists of integers have no
+// boxed elements.
+static inline Value* list_values(HeapValue* l) {
+  uint32_t offset;
+  HeapValue* storage = list_storage(l, &offset);
+  ASSERT(!(storage->flags & HEAP_INTS), "Cannot read a list of integers as values, see list_ints");
+  return storage->as_ptr + offset;
+}
+
+static inline Value list_element(HeapValue* l, uint32_t i) {
+  uint32_t offset;
+  HeapValue* storage = list_storage(l, &offset);
+  if (storage->flags & HEAP_INTS) return MAKE_INTEGER(((int32_t*) storage->as_ptr)[offset + i]);
+  return storage->as_ptr[offset + i];
+}
+
+// Packed elements, for natives, NULL if the list is not packed
+static inline int32_t* list_ints(HeapValue* l) {
+  uint32_t offset;
+  HeapValue* storage = list_storage(l, &offset);
+  return storage->flags & HEAP_INTS ? (int32_t*) storage->as_ptr + offset : NULL;
+}
+
+// Lists built while the nursery is pinned are old but may hold young values
+static inline void gc_list_barrier(GarbageCollector* gc, HeapValue* v) {
+  if (gc_is_young(gc, v)) return;
+  for (uint32_t i = 0; i < heap_fields(v); i++) {
+    if (gc_is_young(gc, (void*) (v->as_ptr[i] & MASK_PAYLOAD_PTR))) {
+      gc_remember(gc, v);
+      return;
+    }
+  }
+}
+
+static inline Value MAKE_STRING(GarbageCollector gc, char* x) {
+  size_t len = strlen(x);
+  HeapValue* v = ALLOC_HEAP_VALUE(gc, TYPE_STRING, len, len + 1);
+  memcpy(v->as_string, x, len + 1);
   return MAKE_PTR(v);
 }
 
+// Hash of the content of a string, computed on first use and cached in its
+// header. Never 0.
+static inline uint16_t string_hash(HeapValue* s) {
+  if (s->hash == 0) {
+    uint32_t h = 2166136261u;
+    for (uint32_t i = 0; i < s->length; i++) h = (h ^ (uint8_t) s->as_string[i]) * 16777619u;
+    h ^= h >> 16;
+    s->hash = (uint16_t) h != 0 ? (uint16_t) h : 1;
+  }
+  return s->hash;
+}
+
+// Tagged and interned strings are unique by content, so two of them are
+// equal only if they are the same. Others are told apart by length and hash
+// before their content is compared.
+static inline bool string_equal(HeapValue* a, HeapValue* b) {
+  if (a == b) return true;
+  if (a->tag != 0 && b->tag != 0) return a->tag == b->tag;
+  if (a->flags & b->flags & HEAP_INTERNED) return false;
+  if (a->length != b->length || string_hash(a) != string_hash(b)) return false;
+  return memcmp(a->as_string, b->as_string, a->length) == 0;
+}
+
 static inline Value MAKE_LIST(GarbageCollector gc, Value* x, uint32_t len) {
-  HeapValue* v = gc_malloc(&gc, sizeof(HeapValue));
-  v->length = len;
-  v->type = TYPE_LIST;
-  v->as_ptr = x;
-  v->refcount = 0;
+  HeapValue* v = ALLOC_HEAP_VALUE(gc, TYPE_LIST, len, len * sizeof(Value));
+  memcpy(v->as_ptr, x, len * sizeof(Value));
+  gc_list_barrier(&gc, v);
+  return MAKE_PTR(v);
+}
+
+// A list of the values `x`, packed if they are all integers and
+// PACKED_INT_LISTS is set. `x` may be on the VM stack, it is read after the
+// allocation.
+static inline Value MAKE_PACKED_LIST(GarbageCollector gc, Value* x, uint32_t len) {
+  bool ints = PACKED_INT_LISTS && len > 0;
+  for (uint32_t i = 0; i < len && ints; i++) ints = (x[i] & MASK_SIGNATURE) == SIGNATURE_INTEGER;
+  if (!ints) return MAKE_LIST(gc, x, len);
+
+  HeapValue* v = ALLOC_HEAP_VALUE(gc, TYPE_LIST, len, len * sizeof(int32_t));
+  int32_t* elements = (int32_t*) v->as_ptr;
+  for (uint32_t i = 0; i < len; i++) elements[i] = (int32_t) (x[i] & MASK_PAYLOAD_INT);
+  v->flags = HEAP_INTS;
   return MAKE_PTR(v);
 }
 
 static inline Value MAKE_MUTABLE(GarbageCollector gc, Value x) {
-  HeapValue* v =gc_malloc(&gc, sizeof(HeapValue));
-  v->length = 1;
-  v->type = TYPE_MUTABLE;
-  v->as_ptr = &x;
-  v->refcount = 0;
+  HeapValue* v = ALLOC_HEAP_VALUE(gc, TYPE_MUTABLE, 1, sizeof(Value));
+  v->as_ptr[0] = x;
+  gc_list_barrier(&gc, v);
   return MAKE_PTR(v);
 }
 
@@ -134,7 +258,7 @@ static inline Value MAKE_MUTABLE(GarbageCollector gc, Value x) {
 
 #define GET_PTR(x) ((HeapValue*)((x) & MASK_PAYLOAD_PTR))
 #define GET_STRING(x) GET_PTR(x)->as_string
-#define GET_LIST(x) GET_PTR(x)->as_ptr
+#define GET_LIST(x) list_values(GET_PTR(x))  // fails on lists of integers, see list_ints
 #define GET_MUTABLE(x) *(GET_PTR(x)->as_ptr)
 
 #define GET_INT(x) ((x) & MASK_PAYLOAD_INT)
@@ -146,6 +270,55 @@ static inline Value MAKE_MUTABLE(GarbageCollector gc, Value x) {
 #define IS_PTR(x) (((x) & MASK_SIGNATURE) == SIGNATURE_POINTER)
 #define IS_FUN(x) (((x) & MASK_SIGNATURE) == SIGNATURE_FUNCTION)
 
+// The elements of the list at `*list` from `start` on, shared with it rather
+// than copied. The list is read from `*list` again after the allocation,
+// which may move it.
+static inline Value MAKE_SLICE(GarbageCollector gc, Value* list, uint32_t start) {
+  HeapValue* view = ALLOC_HEAP_VALUE(gc, TYPE_LIST, GET_PTR(*list)->length - start, sizeof(Value));
+  HeapValue* l = GET_PTR(*list);
+  bool nested = l->flags & HEAP_VIEW;
+  view->flags = HEAP_VIEW;
+  view->offset = (nested ? l->offset : 0) + start;
+  view->as_ptr[0] = nested ? l->as_ptr[0] : *list;
+  gc_list_barrier(&gc, view);
+  return MAKE_PTR(view);
+}
+
+// Precisely marks a value. Only pointer tagged values are followed, integers,
+// floats and functions are skipped. The value's children are marked later by
+// gc_trace_heap_value.
+static inline void gc_mark_value(GarbageCollector* gc, Value value) {
+  if (IS_PTR(value)) gc_mark_traced(gc, GET_PTR(value));
+}
+
+static inline void gc_mark_values(GarbageCollector* gc, Value* values, uint32_t len) {
+  for (uint32_t i = 0; i < len; i++) gc_mark_value(gc, values[i]);
+}
+
+// Deletion barrier: must be called with the value about to be overwritten in
+// a heap object or a global, so that an incremental mark in progress still
+// sees everything that was reachable when it started.
+static inline void gc_value_barrier(GarbageCollector* gc, Value old) {
+  if (gc_marking(gc)) gc_mark_value(gc, old);
+}
+
+// Tracer for heap values, installed with gc_set_tracer.
+static inline void gc_trace_heap_value(GarbageCollector* gc, void* obj) {
+  HeapValue* v = obj;
+
+  switch (v->type) {
+    case TYPE_STRING:
+      break;
+    case TYPE_LIST: case TYPE_MUTABLE:
+      gc_mark_values(gc, v->as_ptr, heap_fields(v));
+      break;
+    default:
+      // Native payloads have no known layout, scan them conservatively.
+      gc_mark_alloc(gc, v->as_any);
+      break;
+  }
+}
+
 static inline ValueType get_type(Value value) {
   uint64_t signature = value & MASK_SIGNATURE;
   if ((~value & MASK_EXPONENT) != 0) return TYPE_FLOAT;
@@ -0,0 +1,31 @@
+#ifndef VERIFIER_H
+#define VERIFIER_H
+
+#include <module.h>
+
+// Checks the structure of a module's bytecode once, before it runs: opcodes,
+// constant, global and local indices, comparison operands, jump targets,
+// function bodies and stack balance. Must run before
+// `fuse_superinstructions`.
+//
+// A module that does not pass is not rejected, it only runs with the checks
+// the verifier would have made redundant.
+bool verify_module(Deserialized *module);
+
+// What instruction `i` pops and pushes, and where control goes after it.
+// `native` tells whether a native function is on top of the stack, which a
+// Call pops with its two indices. Passes that run on verified modules follow
+// the same control flow as the verifier.
+typedef struct {
+  int32_t pops, pushes;
+  int32_t next;    // following instruction, -1 if control does not continue
+  int32_t target;  // jump target, if `jumps`
+  bool jumps;
+  bool native;     // pushes a native function
+  const int32_t *arms;  // jump offsets of the other targets of a Switch
+  int32_t arm_count;
+} Effect;
+
+Effect instruction_effect(Deserialized *module, int32_t i, bool native);
+
+#endif  // VERIFIER_H
@@ -0,0 +1,63 @@
+#include <bytecode.h>
+#include <constructors.h>
+
+// Tags are given by content through an open-addressing table of the first
+// constant spelling each name.
+
+typedef struct {
+  Deserialized *module;
+  int32_t *slots;  // constant index, -1 if empty
+  uint32_t mask;
+  uint32_t next_tag;
+} Tagger;
+
+static uint32_t hash(const char *s) {
+  uint32_t h = 2166136261u;
+  for (; *s != '\0'; s++) h = (h ^ (uint8_t) *s) * 16777619u;
+  return h;
+}
+
+static void tag(Tagger *t, int32_t c) {
+  if (c < 0 || c >= t->module->constant_count) return;
+  Value name = t->module->constants[c];
+  if (get_type(name) != TYPE_STRING || GET_PTR(name)->tag != 0) return;
+
+  uint32_t i = hash(GET_STRING(name)) & t->mask;
+  while (t->slots[i] >= 0) {
+    HeapValue *first = GET_PTR(t->module->constants[t->slots[i]]);
+    if (strcmp(first->as_string, GET_STRING(name)) == 0) {
+      GET_PTR(name)->tag = first->tag;
+      return;
+    }
+    i = (i + 1) & t->mask;
+  }
+  t->slots[i] = c;
+  GET_PTR(name)->tag = t->next_tag++;
+}
+
+// Keys of the table of a Switch, see switches.h
+static void tag_keys(Tagger *t, int32_t first) {
+  if (first < 0 || first >= t->module->constant_count) return;
+  Value n = t->module->constants[first];
+  if (get_type(n) != TYPE_INTEGER) return;
+  int32_t count = (int32_t) GET_INT(n);
+  for (int32_t c = first + 1; count > 0 && c < t->module->constant_count; c += 2, count--) tag(t, c);
+}
+
+void tag_constructors(Deserialized *module) {
+  uint32_t capacity = 16;
+  while (capacity < 2 * (uint32_t) module->constant_count) capacity *= 2;
+
+  Tagger t = { module, malloc(capacity * sizeof(int32_t)), capacity - 1, 1 };
+  for (uint32_t i = 0; i < capacity; i++) t.slots[i] = -1;
+
+  int32_t *instrs = module->instrs;
+  for (int32_t i = 0; i < module->instr_count; i++) {
+    int32_t *in = &instrs[i * 4];
+    if (in[0] == OP_Special && i + 1 < module->instr_count && in[4] == OP_LoadConstant) tag(&t, in[5]);
+    if (in[0] == OP_JumpElseRelCmpConst) tag(&t, in[3]);
+    if (in[0] == OP_Switch) tag_keys(&t, in[1]);
+  }
+
+  free(t.slots);
+}
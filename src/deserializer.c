@@ -3,6 +3,7 @@
 #include <callstack.h>
 #include <core/error.h>
 #include <deserializer.h>
+#include <intern.h>
 #include <module.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -34,11 +35,11 @@ Value deserialize_value(GarbageCollector gc, FILE* file) {
       int32_t length;
       fread(&length, sizeof(int32_t), 1, file);
 
-      char* string_value = gc_malloc(&gc, length + 1);
-      fread(string_value, sizeof(char), length, file);
-      string_value[length] = '\0';
+      HeapValue* string = ALLOC_HEAP_VALUE(gc, TYPE_STRING, length, length + 1);
+      fread(string->as_string, sizeof(char), length, file);
+      string->as_string[length] = '\0';
 
-      value = MAKE_STRING(gc, string_value);
+      value = MAKE_PTR(intern_string(&gc, string));
       break;
     }
 
@@ -49,11 +50,12 @@ Value deserialize_value(GarbageCollector gc, FILE* file) {
   return value;
 }
 
-Constants deserialize_constants(GarbageCollector gc, FILE* file) {
+Constants deserialize_constants(GarbageCollector gc, FILE* file, int32_t* count) {
   Constants constants;
 
   int32_t constant_count;
   fread(&constant_count, sizeof(int32_t), 1, file);
+  *count = constant_count;
 
   constants = gc_malloc(&gc, constant_count * sizeof(Value));
   for (int32_t i = 0; i < constant_count; i++) {
@@ -103,7 +105,8 @@ Libraries deserialize_libraries(GarbageCollector gc, FILE* file) {
 }
 
 Deserialized deserialize(GarbageCollector gc, FILE* file) {
-  Constants constants_ = deserialize_constants(gc, file);
+  int32_t constant_count;
+  Constants constants_ = deserialize_constants(gc, file, &constant_count);
   Libraries libraries = deserialize_libraries(gc, file);
 
   int32_t instr_count;
@@ -116,6 +119,15 @@ Deserialized deserialize(GarbageCollector gc, FILE* file) {
   deserialized.libraries = libraries;
   deserialized.instr_count = instr_count;
   deserialized.instrs = instrs;
+  deserialized.threaded = NULL;
+  deserialized.tail_code = NULL;
+  deserialized.jit = NULL;
+  deserialized.verified = false;
+  deserialized.call_caches = NULL;
+  deserialized.registers = NULL;
+  deserialized.switches = NULL;
+  deserialized.switch_count = 0;
+  deserialized.constant_count = constant_count;
   deserialized.constants = constants_;
   deserialized.stack = stack_new(gc);
   deserialized.callstack = 0;
@@ -0,0 +1,266 @@
+#include <bytecode.h>
+#include <inference.h>
+#include <switches.h>
+#include <verifier.h>
+
+// Types are inferred by abstract interpretation of each function body, on
+// the control flow the verifier checked. The state before an instruction
+// gives every local and stack slot a type, TYPE_UNKNOWN where paths
+// disagree or nothing is known, as for arguments, globals and call results.
+//
+// Instructions checking the type of an operand tell it on the paths that go
+// on after them. When the operand is a copy of a local that has not been
+// stored to since it was loaded, the local gets the type as well, so that in
+//
+//   LoadLocal -1; IJumpElseRelCmpConst ...; LoadLocal -1; SubConst ...
+//
+// the SubConst is known to operate on an integer.
+
+typedef struct {
+  ValueType type;
+  int32_t local;  // local the value is a copy of, 0 if none
+} Slot;
+
+typedef struct {
+  int32_t depth;
+  bool native;
+  Slot slots[];  // locals, then the stack
+} State;
+
+typedef struct {
+  Deserialized *module;
+  State **states;     // before each instruction, NULL if unreached
+  int32_t *worklist;
+  bool *queued;
+  int32_t count;
+  int32_t local_space;  // of the function being inferred
+} Inference;
+
+static State *new_state(Inference *in, int32_t depth) {
+  return malloc(sizeof(State) + (in->local_space + depth) * sizeof(Slot));
+}
+
+static Slot *local(Inference *in, State *s, int32_t l) { return &s->slots[in->local_space + l]; }
+
+// The n-th slot from the top of the stack
+static Slot *top(Inference *in, State *s, int32_t n) { return &s->slots[in->local_space + s->depth - 1 - n]; }
+
+static void push(Inference *in, State *s, ValueType type, int32_t l) {
+  s->depth++;
+  *top(in, s, 0) = (Slot) { type, l };
+}
+
+// The n-th value from the top was checked to be of type `type`
+static void refine(Inference *in, State *s, int32_t n, ValueType type) {
+  int32_t l = top(in, s, n)->local;
+  top(in, s, n)->type = type;
+  if (l == 0) return;
+
+  local(in, s, l)->type = type;
+  for (int32_t k = 0; k < s->depth; k++) {
+    if (top(in, s, k)->local == l) top(in, s, k)->type = type;
+  }
+}
+
+// Turns the state before instruction `i` into the state after it
+static void transfer(Inference *in, int32_t i, State *s, Effect e) {
+  int32_t *instr = &in->module->instrs[i * 4];
+  Constants constants = in->module->constants;
+  ValueType result = TYPE_UNKNOWN;
+  int32_t from = 0;
+
+  switch (instr[0]) {
+    case OP_LoadLocal:
+      result = local(in, s, instr[1])->type;
+      from = instr[1];
+      break;
+    case OP_StoreLocal:
+      *local(in, s, instr[1]) = (Slot) { top(in, s, 0)->type, 0 };
+      for (int32_t k = 0; k < s->depth; k++) {
+        if (top(in, s, k)->local == instr[1]) top(in, s, k)->local = 0;
+      }
+      break;
+    case OP_LoadConstant:
+      result = get_type(constants[instr[1]]);
+      break;
+    case OP_Add: case OP_Sub: case OP_Mul: case OP_And: case OP_Or:
+      refine(in, s, 0, TYPE_INTEGER);
+      refine(in, s, 1, TYPE_INTEGER);
+      result = TYPE_INTEGER;
+      break;
+    case OP_AddConst: case OP_SubConst: case OP_MulConst:
+      refine(in, s, 0, TYPE_INTEGER);
+      result = TYPE_INTEGER;
+      break;
+    case OP_JumpElseRel: case OP_IJumpElseRelCmpConst:
+      refine(in, s, 0, TYPE_INTEGER);
+      break;
+    case OP_JumpElseRelCmpConst:
+      refine(in, s, 0, get_type(constants[instr[3]]));
+      break;
+    case OP_Switch:
+      refine(in, s, 0, in->module->switches[instr[3]]->type);
+      break;
+    case OP_Compare:
+      result = TYPE_INTEGER;
+      break;
+    case OP_ListLength:
+      refine(in, s, 0, TYPE_LIST);
+      result = TYPE_INTEGER;
+      break;
+    case OP_ListGet:
+      refine(in, s, 0, TYPE_LIST);
+      break;
+    case OP_GetIndex:
+      refine(in, s, 0, TYPE_INTEGER);
+      refine(in, s, 1, TYPE_LIST);
+      break;
+    case OP_Slice:
+      refine(in, s, 0, TYPE_LIST);
+      result = TYPE_LIST;
+      break;
+    case OP_MakeList:
+      result = TYPE_LIST;
+      break;
+    case OP_MakeMutable:
+      result = TYPE_MUTABLE;
+      break;
+    case OP_UnMut: case OP_Update:
+      refine(in, s, 0, TYPE_MUTABLE);
+      break;
+    case OP_MakeLambda:
+      result = TYPE_FUNCTION;
+      break;
+    case OP_TypeOf:
+      result = TYPE_STRING;
+      break;
+    case OP_Special:
+      result = TYPE_SPECIAL;
+      break;
+  }
+
+  s->depth -= e.pops;
+  if (instr[0] == OP_LoadNative) {
+    push(in, s, TYPE_INTEGER, 0);
+    push(in, s, TYPE_INTEGER, 0);
+    result = TYPE_STRING;
+  }
+  if (e.pushes > 0) push(in, s, result, from);
+}
+
+// Joins the state `s` into the state before instruction `i`
+static void flow(Inference *in, State *s, int32_t i) {
+  int32_t size = in->local_space + s->depth;
+  State *t = in->states[i];
+
+  if (t == NULL) {
+    t = in->states[i] = new_state(in, s->depth);
+    memcpy(t, s, sizeof(State) + size * sizeof(Slot));
+  } else {
+    bool changed = false;
+    for (int32_t k = 0; k < size; k++) {
+      if (t->slots[k].type != s->slots[k].type && t->slots[k].type != TYPE_UNKNOWN) {
+        t->slots[k].type = TYPE_UNKNOWN;
+        changed = true;
+      }
+      if (t->slots[k].local != s->slots[k].local && t->slots[k].local != 0) {
+        t->slots[k].local = 0;
+        changed = true;
+      }
+    }
+    if (!changed) return;
+  }
+
+  if (!in->queued[i]) {
+    in->queued[i] = true;
+    in->worklist[in->count++] = i;
+  }
+}
+
+static bool is_int(Inference *in, State *s, int32_t n) { return top(in, s, n)->type == TYPE_INTEGER; }
+
+static void specialize(Inference *in, int32_t i, State *s) {
+  int32_t *op = &in->module->instrs[i * 4];
+
+  switch (*op) {
+    case OP_Add: if (is_int(in, s, 0) && is_int(in, s, 1)) *op = OP_AddInt; break;
+    case OP_Sub: if (is_int(in, s, 0) && is_int(in, s, 1)) *op = OP_SubInt; break;
+    case OP_Mul: if (is_int(in, s, 0) && is_int(in, s, 1)) *op = OP_MulInt; break;
+    case OP_AddConst: if (is_int(in, s, 0)) *op = OP_AddConstInt; break;
+    case OP_SubConst: if (is_int(in, s, 0)) *op = OP_SubConstInt; break;
+    case OP_MulConst: if (is_int(in, s, 0)) *op = OP_MulConstInt; break;
+    case OP_IJumpElseRelCmpConst: if (is_int(in, s, 0)) *op = OP_IJumpElseRelCmpConstInt; break;
+  }
+}
+
+static void infer_region(Inference *in, int32_t first, int32_t end, int32_t local_space) {
+  // Functions nested in this one are inferred and freed first
+  for (int32_t i = first; i < end; i++) {
+    int32_t *instr = &in->module->instrs[i * 4];
+    if (instr[0] == OP_MakeLambda) {
+      infer_region(in, i + 1, i + 1 + instr[1], instr[2]);
+      i += instr[1];
+    } else if (instr[0] == OP_MakeAndStoreLambda) {
+      infer_region(in, i + 1, i + 1 + instr[2], instr[3]);
+      i += instr[2];
+    }
+  }
+  if (first == end) return;
+
+  in->local_space = local_space;
+  State *entry = new_state(in, 0);
+  entry->depth = 0;
+  entry->native = false;
+  for (int32_t l = -local_space; l < 0; l++) *local(in, entry, l) = (Slot) { TYPE_UNKNOWN, 0 };
+  flow(in, entry, first);
+  free(entry);
+
+  // State after the instruction, grown with the stack
+  int32_t capacity = 0;
+  State *s = new_state(in, capacity);
+
+  while (in->count > 0) {
+    int32_t i = in->worklist[--in->count];
+    in->queued[i] = false;
+
+    State *before = in->states[i];
+    Effect e = instruction_effect(in->module, i, before->native);
+    if (before->depth + e.pushes > capacity) {
+      capacity = before->depth + e.pushes;
+      free(s);
+      s = new_state(in, capacity);
+    }
+    memcpy(s, before, sizeof(State) + (local_space + before->depth) * sizeof(Slot));
+    transfer(in, i, s, e);
+
+    s->native = e.native;
+    if (e.next >= 0) flow(in, s, e.next);
+    s->native = false;
+    if (e.jumps) flow(in, s, e.target);
+    for (int32_t k = 0; k < e.arm_count; k++) flow(in, s, i + e.arms[k]);
+  }
+  free(s);
+
+  for (int32_t i = first; i < end; i++) {
+    if (in->states[i] == NULL) continue;
+    specialize(in, i, in->states[i]);
+    free(in->states[i]);
+    in->states[i] = NULL;
+  }
+}
+
+void specialize_integers(Deserialized *module) {
+  int32_t n = module->instr_count;
+  Inference in = {
+    .module = module,
+    .states = calloc(n, sizeof(State *)),
+    .worklist = malloc(n * sizeof(int32_t)),
+    .queued = calloc(n, sizeof(bool)),
+  };
+
+  infer_region(&in, 0, n, 0);
+
+  free(in.states);
+  free(in.worklist);
+  free(in.queued);
+}
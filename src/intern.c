@@ -0,0 +1,43 @@
+#include <intern.h>
+
+// Open addressing on the cached hash of the strings. Only the loader
+// interns, on a single thread.
+static HeapValue **table = NULL;
+static uint32_t capacity = 0, count = 0;
+
+static void insert(HeapValue *string) {
+  uint32_t i = string_hash(string) & (capacity - 1);
+  while (table[i] != NULL) i = (i + 1) & (capacity - 1);
+  table[i] = string;
+}
+
+static void grow(void) {
+  HeapValue **old = table;
+  uint32_t old_capacity = capacity;
+
+  capacity = capacity == 0 ? 256 : capacity * 2;
+  table = calloc(capacity, sizeof(HeapValue *));
+  for (uint32_t i = 0; i < old_capacity; i++) {
+    if (old[i] != NULL) insert(old[i]);
+  }
+  free(old);
+}
+
+HeapValue *intern_string(GarbageCollector *gc, HeapValue *string) {
+  if (gc_is_young(gc, string)) return string;
+  if (2 * (count + 1) > capacity) grow();
+
+  uint32_t i = string_hash(string) & (capacity - 1);
+  for (; table[i] != NULL; i = (i + 1) & (capacity - 1)) {
+    HeapValue *other = table[i];
+    if (other->hash == string->hash && other->length == string->length &&
+        memcmp(other->as_string, string->as_string, string->length) == 0) {
+      return other;
+    }
+  }
+
+  string->flags |= HEAP_INTERNED;
+  table[i] = string;
+  count++;
+  return string;
+}
@@ -5,21 +5,79 @@
 #include <core/error.h>
 #include <core/library.h>
 #include <interpreter.h>
+#include <jit.h>
 #include <module.h>
+#include <natives.h>
+#include <registers.h>
 #include <stack.h>
 #include <stdio.h>
+#include <switches.h>
 #include <value.h>
 
-#define INCREASE_IP_BY(mod, x) (mod->pc += ((x) * 4))
-#define INCREASE_IP(mod) INCREASE_IP_BY(mod, 1)
+#define INCREASE_IP_BY(x) (pc += ((x) * 4))
+#define INCREASE_IP() INCREASE_IP_BY(1)
 
 int halt = 0;
 
+// Build with -DPROFILE_OPCODE_PAIRS=1 to count how often each opcode follows
+// another; the most frequent pairs are printed at exit. This is what the
+// superinstructions in superinstructions.c are chosen from.
+#if PROFILE_OPCODE_PAIRS
+static uint64_t opcode_pairs[OPCODE_COUNT][OPCODE_COUNT];
+static int32_t last_opcode = -1;
+
+static void print_opcode_pairs(void) {
+  fprintf(stderr, "Most frequent opcode pairs:\n");
+  for (int n = 0; n < 20; n++) {
+    int32_t first = 0, second = 0;
+    for (int32_t a = 0; a < OPCODE_COUNT; a++)
+      for (int32_t b = 0; b < OPCODE_COUNT; b++)
+        if (opcode_pairs[a][b] > opcode_pairs[first][second]) first = a, second = b;
+    if (opcode_pairs[first][second] == 0) break;
+    fprintf(stderr, "  %2d %2d  %llu\n", first, second,
+            (unsigned long long) opcode_pairs[first][second]);
+    opcode_pairs[first][second] = 0;
+  }
+}
+
+static inline void profile_opcode(int32_t opcode) {
+  if (last_opcode < 0) atexit(print_opcode_pairs);
+  else opcode_pairs[last_opcode][opcode]++;
+  last_opcode = opcode;
+}
+
+#define PROFILE_OPCODE() profile_opcode(op)
+#else
+#define PROFILE_OPCODE()
+#endif
+
+// With direct threading, the instructions are translated once into handler
+// addresses followed by their operands, and dispatch is a single indirect
+// jump through the current instruction. Otherwise every dispatch looks the
+// opcode up in the jump table.
+#ifndef DIRECT_THREADING
+#define DIRECT_THREADING 1
+#endif
+
+#if DIRECT_THREADING
+#define DISPATCH() do { PROFILE_OPCODE(); goto *code[pc >> 2].handler; } while (0)
+#else
+#define DISPATCH() do { PROFILE_OPCODE(); goto *jmp_table[op]; } while (0)
+#endif
+
+// Entry points that only threaded code jumps to: the handlers of verified
+// modules, past the checks they do not need, and quickened calls
+#if DIRECT_THREADING
+#define THREADED_LABEL(name) name:
+#else
+#define THREADED_LABEL(name)
+#endif
+
 Value list_get(Value list, int32_t idx) {
   HeapValue* l = GET_PTR(list);
   if (idx < 0 || idx >= l->length) THROW_FMT("Invalid index, received %d", idx);
 
-  return l->as_ptr[idx];
+  return list_element(l, idx);
 }
 
 Value call_function(Deserialized *module, Value func, int32_t argc, Value* argv) {
@@ -36,6 +94,7 @@ Value call_function(Deserialized *module, Value func, int32_t argc, Value* argv)
   int16_t local_space = (int16_t) ((callee >> 16) & MASK_PAYLOAD_INT);
   int16_t old_sp = module->stack->stack_pointer - argc;
 
+  clear_locals(&module->stack->values[module->stack->stack_pointer], local_space - argc);
   module->stack->stack_pointer += local_space - argc;
 
   int32_t new_pc = module->pc + 4;
@@ -75,6 +134,7 @@ Value call_threaded(Deserialized *module, Value func, int32_t argc, Value* argv)
   int16_t local_space = (int16_t) ((callee >> 16) & MASK_PAYLOAD_INT);
   int16_t old_sp = new_module->stack->stack_pointer - argc;
 
+  clear_locals(&new_module->stack->values[new_module->stack->stack_pointer], local_space - argc);
   new_module->stack->stack_pointer += local_space - argc;
 
   int32_t new_pc = module->pc + 4;
@@ -84,8 +144,18 @@ Value call_threaded(Deserialized *module, Value func, int32_t argc, Value* argv)
   new_module->base_pointer = new_module->stack->stack_pointer - 1;
   new_module->callstack++;
 
+  new_module->libraries = module->libraries;
   new_module->instr_count = module->instr_count;
   new_module->instrs = module->instrs;
+  new_module->threaded = module->threaded;
+  new_module->tail_code = module->tail_code;
+  new_module->call_caches = module->call_caches;
+  new_module->registers = module->registers;
+  new_module->switches = module->switches;
+  new_module->switch_count = module->switch_count;
+  new_module->jit = module->jit;
+  new_module->verified = module->verified;
+  new_module->constant_count = module->constant_count;
   new_module->constants = module->constants;
   new_module->gc = module->gc;
   new_module->natives = module->natives;
@@ -97,14 +167,18 @@ Value call_threaded(Deserialized *module, Value func, int32_t argc, Value* argv)
 
   // module->pc = new_pc;
 
+  // The new interpreter may run on another thread, young objects it shares
+  // with its parent must not move under it.
+  gc_add_root(&module->gc, module_mark_roots, new_module);
+  gc_nursery_pin(&module->gc);
   Value ret = run_interpreter(new_module, ipc, true, new_module->callstack - 1);
+  gc_nursery_unpin(&module->gc);
+  gc_remove_root(&module->gc, module_mark_roots, new_module);
 
   return ret;
 }
 
 
-typedef Value (*ComparisonFun)(Value, Value);
-
 Value compare_eq(Value a, Value b) {
   ValueType a_type = get_type(a);
   ASSERT_FMT(a_type == get_type(b), "Cannot compare values of different types: %s and %s", type_of(a), type_of(b));
@@ -114,17 +188,8 @@ Value compare_eq(Value a, Value b) {
       return MAKE_INTEGER(a == b);
     case TYPE_FLOAT:
       return MAKE_INTEGER(GET_FLOAT(a) == GET_FLOAT(b));
-    case TYPE_STRING: {
-      HeapValue* a_ptr = GET_PTR(a);
-      HeapValue* b_ptr = GET_PTR(b);
-
-      size_t a_len = strlen(a_ptr->as_string);
-      size_t b_len = strlen(b_ptr->as_string);
-
-      if (a_len != b_len) return MAKE_INTEGER(0);
-
-      return MAKE_INTEGER(strcmp(a_ptr->as_string, b_ptr->as_string) == 0);
-    }
+    case TYPE_STRING:
+      return MAKE_INTEGER(string_equal(GET_PTR(a), GET_PTR(b)));
     case TYPE_FUNCTION: case TYPE_FUNCENV: case TYPE_MUTABLE: {
       return MAKE_INTEGER(a == b);
     }
@@ -135,7 +200,7 @@ Value compare_eq(Value a, Value b) {
       if (a_ptr->length != b_ptr->length) return MAKE_INTEGER(0);
 
       for (uint32_t i = 0; i < a_ptr->length; i++) {
-        if (!compare_eq(a_ptr->as_ptr[i], b_ptr->as_ptr[i])) return MAKE_INTEGER(0);
+        if (!compare_eq(list_element(a_ptr, i), list_element(b_ptr, i))) return MAKE_INTEGER(0);
       }
 
       return MAKE_INTEGER(1);
@@ -163,26 +228,7 @@ Value compare_gt(Value a, Value b) {
 
 ComparisonFun comparison_table[] = { NULL, compare_gt, compare_eq, NULL, NULL, compare_and, compare_or };
 
-void op_call(Deserialized *module, Value callee, int32_t argc) {
-  ASSERT_FMT(module->callstack < MAX_FRAMES, "Call stack overflow, reached %d", module->callstack);
-
-  int16_t ipc = (int16_t) (callee & MASK_PAYLOAD_INT);
-  int16_t local_space = (int16_t) ((callee >> 16) & MASK_PAYLOAD_INT);
-  int16_t old_sp = module->stack->stack_pointer - argc;
-
-  module->stack->stack_pointer += local_space - argc;
-
-  int32_t new_pc = module->pc + 4;
-
-  stack_push(module->stack, MAKE_FUNCENV(new_pc, old_sp, module->base_pointer));
-
-  module->base_pointer = module->stack->stack_pointer - 1;
-  module->callstack++;
-
-  module->pc = ipc;
-}
-
-void op_native_call(Deserialized *module, Value callee, int32_t argc) {
+Native resolve_native(Deserialized *module, Value callee) {
   char* fun = GET_NATIVE(callee);
 
   Value libIdx = stack_pop(module->stack);
@@ -200,44 +246,123 @@ void op_native_call(Deserialized *module, Value callee, int32_t argc) {
   if (module->natives[lib_name].functions[lib_idx] == NULL) {
     void* lib = module->handles[lib_name];
     ASSERT_FMT(lib != NULL, "Library with function %s not loaded", fun);
-    Native nfun = get_proc_address(lib, fun);
+    Native nfun = (Native) get_proc_address(lib, fun);
+    if (nfun == NULL) nfun = builtin_native(fun);
     ASSERT_FMT(nfun != NULL, "Native function %s not found", fun);
     module->natives[lib_name].functions[lib_idx] = nfun;
-
-    Value* args = stack_pop_n(module->stack, argc);
-    Value ret = nfun(argc, module, args);
-    stack_push(module->stack, ret);
-  } else {
-    Native nfun = module->natives[lib_name].functions[lib_idx];
-    ASSERT_FMT(nfun != NULL, "Native function %s not found", fun);
-
-    Value* args = stack_pop_n(module->stack, argc);
-    Value ret = nfun(argc, module, args);
-
-    stack_push(module->stack, ret);
   }
 
-  module->pc += 4;
+  Native nfun = module->natives[lib_name].functions[lib_idx];
+  ASSERT_FMT(nfun != NULL, "Native function %s not found", fun);
+  return nfun;
 }
 
-typedef void (*InterpreterFunc)(Deserialized*, Value, int32_t);
+void invoke_native(Deserialized *module, Native native, int32_t argc) {
+  // Arguments stay below the stack pointer so that they remain GC roots
+  // while the native runs. Natives may hold young pointers in C locals, so
+  // the nursery is pinned for the duration of the call.
+  int16_t sp = module->stack->stack_pointer;
+  Value* args = &module->stack->values[sp - argc];
 
-InterpreterFunc interpreter_table[] = { op_native_call, op_call };
+  gc_nursery_pin(&module->gc);
+  Value ret = native(argc, module, args);
+  gc_nursery_unpin(&module->gc);
 
-Value run_interpreter(Deserialized *module, int32_t ipc, bool does_return, int32_t current_callstack) {
+  module->stack->stack_pointer = sp - argc;
+  stack_push(module->stack, ret);
+}
+
+// The interpreter keeps the program counter, stack pointer and base pointer
+// in locals. They are written back to the module before anything that may
+// look at it: native calls, which may re-enter through call_function,
+// allocations, which may collect and scan the stack, and leaving the loop.
+#define SAVE_SP() (module->stack->stack_pointer = (int16_t) (sp - values))
+#define SAVE_STATE() (module->pc = pc, SAVE_SP(), module->base_pointer = bp)
+#define LOAD_STATE() \
+  (pc = module->pc, sp = values + module->stack->stack_pointer, bp = module->base_pointer)
+
+#define PUSH(value) (*sp++ = (value))
+#define POP() (*--sp)
+
+// Calls in verified modules are quickened: the first time they run, the
+// callee is cached and the threaded handler is replaced by one that only
+// compares the callee with the cache. The handler is stored last, so that
+// threads sharing the code never run it with an empty cache.
+#if DIRECT_THREADING
+#define QUICKEN(quickened, callee_, native_)                              \
+  do {                                                                    \
+    void* handler_ = (quickened);                                         \
+    if (!module->verified || handler_ == NULL) break;                     \
+    caches[pc >> 2].native = (native_);                                   \
+    caches[pc >> 2].callee = (callee_);                                   \
+    __atomic_store_n(&code[pc >> 2].handler, handler_, __ATOMIC_RELEASE); \
+  } while (0)
+#else
+#define QUICKEN(quickened, callee, native) ((void) 0)
+#endif
+
+// Compiled code, if any, is entered at function entries and return
+// addresses, and runs until an instruction it cannot execute.
+#if JIT
+#define JIT_ENTER()                                                     \
+  do {                                                                  \
+    JitExit exit_ = jit_run(jit, pc, values, sp, bp, constants);        \
+    pc = exit_.pc;                                                      \
+    sp = exit_.sp;                                                      \
+  } while (0)
+#define JIT_COUNT_CALL(ipc) jit_count_call(module, (ipc))
+#else
+#define JIT_ENTER()
+#define JIT_COUNT_CALL(ipc)
+#endif
+
+// Register code (see registers.h) is entered at the same points, from
+// wherever compiled code stopped.
+#if REGISTER_TIER
+#define REGISTERS_ENTER()                                               \
+  do {                                                                  \
+    RegisterExit exit_ = registers_enter(module, pc, sp, bp);           \
+    pc = exit_.pc;                                                      \
+    sp = exit_.sp;                                                      \
+  } while (0)
+#else
+#define REGISTERS_ENTER()
+#endif
+
+Value run_interpreter_loop(Deserialized *module, int32_t ipc, bool does_return, int32_t current_callstack) {
   Constants constants = module->constants;
   int32_t* bytecode = module->instrs;
   GarbageCollector gc = module->gc;
-  module->pc = ipc;
+  Value* values = module->stack->values;
+
+  int32_t pc = ipc;
+  Value* sp = values + module->stack->stack_pointer;
+  int32_t bp = module->base_pointer;
 
-  #define op bytecode[module->pc]
-  #define i1 bytecode[module->pc + 1]
-  #define i2 bytecode[module->pc + 2]
-  #define i3 bytecode[module->pc + 3]
+  // Operands of a call, shared by the call instructions
+  Value callee;
+  int32_t argc;
+
+  #define op bytecode[pc]
+
+#if DIRECT_THREADING
+  #define i1 code[pc >> 2].operands[0]
+  #define i2 code[pc >> 2].operands[1]
+  #define i3 code[pc >> 2].operands[2]
+
+  // Operand k of the n-th instruction after the current one
+  #define in(n, k) code[(pc >> 2) + (n)].operands[(k) - 1]
+#else
+  #define i1 bytecode[pc + 1]
+  #define i2 bytecode[pc + 2]
+  #define i3 bytecode[pc + 3]
+
+  #define in(n, k) bytecode[pc + 4 * (n) + (k)]
+#endif
 
   #define UNKNOWN &&case_unknown
 
-  void* jmp_table[] = {
+  static void* const jmp_table[] = {
     &&case_load_local, &&case_store_local, &&case_load_constant,
     &&case_load_global, &&case_store_global, &&case_return,
     &&case_compare, &&case_and, &&case_or, &&case_load_native,
@@ -251,164 +376,360 @@ Value run_interpreter(Deserialized *module, int32_t ipc, bool does_return, int32
     &&case_jump_else_rel_cmp_constant,
     &&case_ijump_else_rel_cmp_constant, &&case_call_global,
     &&case_call_local, &&case_make_and_store_lambda, &&case_mul,
-    &&case_mul_const, &&case_return_unit };
+    &&case_mul_const, &&case_return_unit, &&case_switch,
+    &&case_add_int, &&case_sub_int, &&case_mul_int, &&case_add_const_int,
+    &&case_sub_const_int, &&case_mul_const_int,
+    &&case_ijump_else_rel_cmp_constant_int,
+    &&case_load_local_load_local_add, &&case_load_local_sub_const,
+    &&case_load_local_return, &&case_load_local_ijump_else_rel_cmp_constant,
+    &&case_load_local_call_global, &&case_load_global_list_get,
+    &&case_load_global_ijump_else_rel_cmp_constant,
+    &&case_load_global_add_const_store_global, &&case_store_global_jump_rel,
+    &&case_load_local_load_local_add_int, &&case_load_local_sub_const_int,
+    &&case_load_local_ijump_else_rel_cmp_constant_int,
+    &&case_tail_call, &&case_tail_call_global, &&case_tail_call_local };
+
+#if DIRECT_THREADING
+  // Handlers of verified modules, where they differ. Without direct
+  // threading, verified modules run the checked handlers.
+  static void* const verified_table[OPCODE_COUNT] = {
+    [OP_Compare] = &&case_compare_verified,
+    [OP_LoadNative] = &&case_load_native_verified,
+    [OP_AddConst] = &&case_add_const_verified,
+    [OP_SubConst] = &&case_sub_const_verified,
+    [OP_MulConst] = &&case_mul_const_verified,
+    [OP_JumpElseRelCmp] = &&case_jump_else_rel_cmp_verified,
+    [OP_IJumpElseRelCmp] = &&case_ijump_else_rel_cmp_verified,
+    [OP_IJumpElseRelCmpConst] = &&case_ijump_else_rel_cmp_constant_verified,
+    [OP_LoadLocalSubConst] = &&case_load_local_sub_const_verified,
+    [OP_LoadLocalIJumpElseRelCmpConst] = &&case_load_local_ijump_else_rel_cmp_constant_verified,
+    [OP_LoadGlobalIJumpElseRelCmpConst] = &&case_load_global_ijump_else_rel_cmp_constant_verified,
+    [OP_LoadGlobalAddConstStoreGlobal] = &&case_load_global_add_const_store_global_verified };
+
+  // Translated the first time the module runs, shared with threads it spawns
+  if (module->threaded == NULL) {
+    ThreadedInstruction* threaded = gc_malloc(&gc, module->instr_count * sizeof(ThreadedInstruction));
+    for (int32_t i = 0; i < module->instr_count; i++) {
+      int32_t opcode = bytecode[i * 4];
+      bool known = opcode >= 0 && opcode < (int32_t) (sizeof(jmp_table) / sizeof(*jmp_table));
+      threaded[i].handler = known ? jmp_table[opcode] : UNKNOWN;
+      if (known && module->verified && verified_table[opcode] != NULL) threaded[i].handler = verified_table[opcode];
+      memcpy(threaded[i].operands, &bytecode[i * 4 + 1], sizeof(threaded[i].operands));
+    }
+    module->threaded = threaded;
+  }
+  ThreadedInstruction* code = module->threaded;
 
-  goto *jmp_table[op];
+  // Handlers of quickened calls of bytecode functions
+  static void* const quickened_table[OPCODE_COUNT] = {
+    [OP_Call] = &&case_call_quickened,
+    [OP_CallGlobal] = &&case_call_global_quickened,
+    [OP_CallLocal] = &&case_call_local_quickened };
 
-  case_load_local: {
-    int32_t locals = module->base_pointer;
+  if (module->call_caches == NULL) module->call_caches = gc_calloc(&gc, module->instr_count, sizeof(CallCache));
+  CallCache* caches = module->call_caches;
+#endif
 
-    Value value = module->stack->values[locals + i1];
-    stack_push(module->stack, value);
-    INCREASE_IP(module);
-    goto *jmp_table[op];
+#if JIT
+  if (module->jit == NULL) module->jit = jit_new(module);
+  Jit* jit = module->jit;
+#endif
+
+  DISPATCH();
+
+  case_load_local: {
+    PUSH(values[bp + i1]);
+    INCREASE_IP();
+    DISPATCH();
   }
 
   case_store_local: {
-    int32_t locals = module->base_pointer;
-    module->stack->values[locals + i1] = stack_pop(module->stack);
-    INCREASE_IP(module);
-    goto *jmp_table[op];
+    values[bp + i1] = POP();
+    INCREASE_IP();
+    DISPATCH();
   }
 
   case_load_constant: {
-    Value value = constants[i1];
-    stack_push(module->stack, value);
-    INCREASE_IP(module);
-    goto *jmp_table[op];
+    PUSH(constants[i1]);
+    INCREASE_IP();
+    DISPATCH();
   }
 
   case_load_global: {
-    Value value = module->stack->values[i1];
-    stack_push(module->stack, value);
-    INCREASE_IP(module);
-    goto *jmp_table[op];
+    PUSH(values[i1]);
+    INCREASE_IP();
+    DISPATCH();
   }
 
   case_store_global: {
-    module->stack->values[i1] = stack_pop(module->stack);
-    INCREASE_IP(module);
-    goto *jmp_table[op];
+    gc_value_barrier(&gc, values[i1]);
+    values[i1] = POP();
+    INCREASE_IP();
+    DISPATCH();
   }
 
   case_return: {
-    Frame fr = pop_frame(module);
-    Value ret = stack_pop(module->stack);
+    Frame fr = read_frame(values[bp]);
+    module->callstack--;
+    Value ret = POP();
 
-    module->stack->stack_pointer = fr.stack_pointer;
-    module->base_pointer = fr.base_ptr;
-    stack_push(module->stack, ret);
+    sp = values + fr.stack_pointer;
+    bp = fr.base_ptr;
+    PUSH(ret);
 
-    module->pc = fr.instruction_pointer;
+    pc = fr.instruction_pointer;
 
-    if (does_return && current_callstack == module->callstack) 
+    if (does_return && current_callstack == module->callstack) {
+      SAVE_STATE();
       return ret;
+    }
 
-    goto *jmp_table[op];
+    JIT_ENTER();
+    REGISTERS_ENTER();
+    DISPATCH();
   }
 
-  case_compare: {
-    Value a = stack_pop(module->stack);
-    Value b = stack_pop(module->stack);
+  // Handlers followed by a `_verified` label start with checks the verifier
+  // makes once at load. Verified modules are threaded to the label. The
+  // checks of operand types come before an `_int` label, which integer
+  // variants (see inference.c) dispatch to.
 
-    stack_push(module->stack, comparison_table[i1](b, a));
-    INCREASE_IP(module);
-    goto *jmp_table[op];
+  case_compare:
+    ASSERT_FMT(valid_comparison(i1), "Invalid comparison %d", i1);
+  THREADED_LABEL(case_compare_verified) {
+    Value a = POP();
+    Value b = POP();
+
+    PUSH(comparison_table[i1](b, a));
+    INCREASE_IP();
+    DISPATCH();
   }
 
   case_and: {
-    Value a = stack_pop(module->stack);
-    Value b = stack_pop(module->stack);
+    Value a = POP();
+    Value b = POP();
 
     ASSERT_FMT(get_type(a) == TYPE_INTEGER && get_type(b) == TYPE_INTEGER, "Expected integers, got %s and %s", type_of(a), type_of(b));
 
-    stack_push(module->stack, MAKE_INTEGER(a && b));
-    INCREASE_IP(module);
-    goto *jmp_table[op];
+    PUSH(MAKE_INTEGER(a && b));
+    INCREASE_IP();
+    DISPATCH();
   }
 
   case_or: {
-    Value a = stack_pop(module->stack);
-    Value b = stack_pop(module->stack);
+    Value a = POP();
+    Value b = POP();
 
     ASSERT_FMT(get_type(a) == TYPE_INTEGER && get_type(b) == TYPE_INTEGER, "Expected integers, got %s and %s", type_of(a), type_of(b));
 
-    stack_push(module->stack, MAKE_INTEGER(a || b));
-    INCREASE_IP(module);
-    goto *jmp_table[op];
+    PUSH(MAKE_INTEGER(a || b));
+    INCREASE_IP();
+    DISPATCH();
   }
 
-  case_load_native: {
+  case_load_native:
+    ASSERT(get_type(constants[i1]) == TYPE_STRING, "Invalid native function name type");
+  THREADED_LABEL(case_load_native_verified) {
     Value name = constants[i1];
-    ASSERT(get_type(name) == TYPE_STRING, "Invalid native function name type");
-    stack_push(module->stack, MAKE_INTEGER(i2));
-    stack_push(module->stack, MAKE_INTEGER(i3));
-    stack_push(module->stack, name);
-    INCREASE_IP(module);
-    goto *jmp_table[op];
+    PUSH(MAKE_INTEGER(i2));
+    PUSH(MAKE_INTEGER(i3));
+    PUSH(name);
+    INCREASE_IP();
+    DISPATCH();
   }
 
   case_make_list: {
-    Value* values = gc_malloc(&gc, sizeof(Value) * i1);
-    memcpy(values, stack_pop_n(module->stack, i1),
-            i1 * sizeof(Value));
-    stack_push(module->stack, MAKE_LIST(module->gc, values, i1));
-    INCREASE_IP(module);
-    goto *jmp_table[op];
+    // Elements stay on the stack until the allocation succeeded
+    SAVE_SP();
+    Value list = MAKE_PACKED_LIST(gc, sp - i1, i1);
+    sp -= i1;
+    PUSH(list);
+    INCREASE_IP();
+    DISPATCH();
   }
 
   case_list_get: {
-    Value list = stack_pop(module->stack);
+    Value list = POP();
     uint32_t idx = GET_INT(i1);
-    ASSERT_FMT(get_type(list) == TYPE_LIST, "Invalid list type at IPC %d", module->pc / 4);
+    ASSERT_FMT(get_type(list) == TYPE_LIST, "Invalid list type at IPC %d", pc / 4);
     HeapValue* l = GET_PTR(list);
     ASSERT(idx < l->length, "Index out of bounds");
-    stack_push(module->stack, l->as_ptr[idx]);
-    INCREASE_IP(module);
-    goto *jmp_table[op];
+    PUSH(list_element(l, idx));
+    INCREASE_IP();
+    DISPATCH();
   }
 
   case_call: {
-    Value callee = stack_pop(module->stack);
+    callee = POP();
+    argc = i1;
+    goto call;
+  }
+
+  case_call_global: {
+    callee = values[i1];
+    argc = i2;
+    goto call;
+  }
+
+  case_call_local: {
+    callee = values[bp + i1];
+    argc = i2;
+    goto call;
+  }
 
+  call: {
     ASSERT(IS_FUN(callee) || IS_PTR(callee), "Invalid callee type");
-    
-    interpreter_table[(callee & MASK_SIGNATURE) == SIGNATURE_FUNCTION](module, callee, i1);
 
-    goto *jmp_table[op];
+    if ((callee & MASK_SIGNATURE) != SIGNATURE_FUNCTION) {
+      SAVE_STATE();
+      Native native = resolve_native(module, callee);
+      if (op == OP_Call) QUICKEN(&&case_call_native_quickened, callee, native);
+      invoke_native(module, native, argc);
+      LOAD_STATE();
+      INCREASE_IP();
+      DISPATCH();
+    }
+
+    QUICKEN(quickened_table[op], callee, NULL);
+  }
+
+  THREADED_LABEL(call_function) {
+    ASSERT_FMT(module->callstack < MAX_FRAMES, "Call stack overflow, reached %d", module->callstack);
+
+    int16_t ipc = (int16_t) (callee & MASK_PAYLOAD_INT);
+    int16_t local_space = (int16_t) ((callee >> 16) & MASK_PAYLOAD_INT);
+    int16_t old_sp = (int16_t) (sp - values) - argc;
+
+    clear_locals(sp, local_space - argc);
+    sp += local_space - argc;
+    PUSH(MAKE_FUNCENV(pc + 4, old_sp, bp));
+
+    bp = (int32_t) (sp - values) - 1;
+    module->callstack++;
+
+    pc = ipc;
+    JIT_COUNT_CALL(ipc);
+    JIT_ENTER();
+    REGISTERS_ENTER();
+    DISPATCH();
+  }
+
+  // Quickened calls, see QUICKEN. Another callee than the cached one takes
+  // the generic path, which caches it instead.
+
+#if DIRECT_THREADING
+  case_call_quickened: {
+    callee = POP();
+    argc = i1;
+    if (callee != caches[pc >> 2].callee) goto call;
+    goto call_function;
+  }
+
+  case_call_global_quickened: {
+    callee = values[i1];
+    argc = i2;
+    if (callee != caches[pc >> 2].callee) goto call;
+    goto call_function;
+  }
+
+  case_call_local_quickened: {
+    callee = values[bp + i1];
+    argc = i2;
+    if (callee != caches[pc >> 2].callee) goto call;
+    goto call_function;
+  }
+
+  case_call_native_quickened: {
+    callee = POP();
+    argc = i1;
+    if (callee != caches[pc >> 2].callee) goto call;
+
+    // The library and function indices
+    sp -= 2;
+    SAVE_STATE();
+    invoke_native(module, caches[pc >> 2].native, argc);
+    LOAD_STATE();
+    INCREASE_IP();
+    DISPATCH();
+  }
+#endif
+
+  // Tail calls, a call followed by a Return. A native is called as usual
+  // and the Return runs after it. A bytecode function takes over the frame
+  // of the caller: its arguments move down to where the caller's were, and
+  // it returns where the caller would have.
+
+  case_tail_call: {
+    callee = POP();
+    argc = i1;
+    goto tail_call;
+  }
+
+  case_tail_call_global: {
+    callee = values[i1];
+    argc = i2;
+    goto tail_call;
+  }
+
+  case_tail_call_local: {
+    callee = values[bp + i1];
+    argc = i2;
+    goto tail_call;
+  }
+
+  tail_call: {
+    if ((callee & MASK_SIGNATURE) != SIGNATURE_FUNCTION) goto call;
+
+    Value env = values[bp];
+    int16_t old_sp = (int16_t) read_frame(env).stack_pointer;
+    int16_t ipc = (int16_t) (callee & MASK_PAYLOAD_INT);
+    int16_t local_space = (int16_t) ((callee >> 16) & MASK_PAYLOAD_INT);
+
+    memmove(values + old_sp, sp - argc, argc * sizeof(Value));
+    clear_locals(values + old_sp + argc, local_space - argc);
+    sp = values + old_sp + local_space;
+    PUSH(env);
+    bp = (int32_t) (sp - values) - 1;
+
+    pc = ipc;
+    JIT_COUNT_CALL(ipc);
+    JIT_ENTER();
+    REGISTERS_ENTER();
+    DISPATCH();
   }
 
   case_jump_else_rel: {
-    Value value = stack_pop(module->stack);
+    Value value = POP();
     ASSERT(get_type(value) == TYPE_INTEGER, "Invalid value type")
     if (GET_INT(value) == 0) {
-      INCREASE_IP_BY(module, i1);
+      INCREASE_IP_BY(i1);
     } else {
-      INCREASE_IP(module);
+      INCREASE_IP();
     }
-    goto *jmp_table[op];
+    DISPATCH();
   }
 
   case_type_of: {
-    Value value = stack_pop(module->stack);
-    stack_push(module->stack, MAKE_STRING(module->gc, type_of(value)));
-    INCREASE_IP(module);
-    goto *jmp_table[op];
+    Value value = POP();
+    SAVE_SP();
+    PUSH(MAKE_STRING(module->gc, type_of(value)));
+    INCREASE_IP();
+    DISPATCH();
   }
 
   case_make_lambda: {
-    int32_t new_pc = module->pc + 4;
+    int32_t new_pc = pc + 4;
     Value lambda = MAKE_FUNCTION(new_pc, i2);
 
-    stack_push(module->stack, lambda);
-    INCREASE_IP_BY(module, i1 + 1);
+    PUSH(lambda);
+    INCREASE_IP_BY(i1 + 1);
 
-    goto *jmp_table[op];
+    DISPATCH();
   }
 
   case_get_index: {
-    Value index = stack_pop(module->stack);
-    Value list = stack_pop(module->stack);
+    Value index = POP();
+    Value list = POP();
     ASSERT(get_type(list) == TYPE_LIST, "Invalid list type");
     ASSERT(get_type(index) == TYPE_INTEGER, "Invalid index type");
 
@@ -416,162 +737,174 @@ Value run_interpreter(Deserialized *module, int32_t ipc, bool does_return, int32
     uint32_t idx = GET_INT(index);
 
     ASSERT(idx < l->length, "Index out of bounds");
-    stack_push(module->stack, l->as_ptr[idx]);
-    INCREASE_IP(module);
-    goto *jmp_table[op];
+    PUSH(list_element(l, idx));
+    INCREASE_IP();
+    DISPATCH();
   }
 
   case_special: {
-    stack_push(module->stack, MAKE_SPECIAL());
-    INCREASE_IP(module);
-    goto *jmp_table[op];
+    PUSH(MAKE_SPECIAL());
+    INCREASE_IP();
+    DISPATCH();
   }
 
   case_jump_rel: {
-    INCREASE_IP_BY(module, i1);
-    goto *jmp_table[op];
+    INCREASE_IP_BY(i1);
+    DISPATCH();
   }
 
   case_slice: {
-    Value list = stack_pop(module->stack);
-    ASSERT(get_type(list) == TYPE_LIST, "Invalid list type");
-    HeapValue* l = GET_PTR(list);
-    HeapValue* new_list = gc_malloc(&gc, sizeof(HeapValue));
-
-    new_list->type = TYPE_LIST;
-    new_list->length = l->length - i1;
-    new_list->as_ptr = gc_malloc(&gc, sizeof(Value) * new_list->length);
-
-    memcpy(new_list->as_ptr, &l->as_ptr[i1], (l->length - i1) * sizeof(Value));
-    stack_push(module->stack, MAKE_PTR(new_list));
-    INCREASE_IP(module);
-    goto *jmp_table[op];
+    ASSERT(get_type(sp[-1]) == TYPE_LIST, "Invalid list type");
+    ASSERT(i1 >= 0 && (uint32_t) i1 <= GET_PTR(sp[-1])->length, "Slice out of bounds");
+
+    // The source list stays on the stack while the view is allocated
+    SAVE_SP();
+    sp[-1] = MAKE_SLICE(gc, &sp[-1], i1);
+    INCREASE_IP();
+    DISPATCH();
   }
 
   case_list_length: {
-    Value list = stack_pop(module->stack);
-    ASSERT_FMT(get_type(list) == TYPE_LIST, "Invalid list type at IPC %d", module->pc / 4);
+    Value list = POP();
+    ASSERT_FMT(get_type(list) == TYPE_LIST, "Invalid list type at IPC %d", pc / 4);
     HeapValue* l = GET_PTR(list);
-    stack_push(module->stack, MAKE_INTEGER(l->length));
-    INCREASE_IP(module);
-    goto *jmp_table[op];
+    PUSH(MAKE_INTEGER(l->length));
+    INCREASE_IP();
+    DISPATCH();
   }
 
   case_halt: {
     halt = 1;
+    SAVE_STATE();
     return 0;
   }
 
   case_update: {
-    Value var = stack_pop(module->stack);
+    Value var = POP();
     ASSERT(get_type(var) == TYPE_MUTABLE, "Invalid mutable type");
 
     HeapValue* l = GET_PTR(var);
 
-    Value value = stack_pop(module->stack);
-    memcpy(l->as_ptr, &value, sizeof(Value));
-    INCREASE_IP(module);
-    goto *jmp_table[op];
+    Value value = POP();
+    gc_value_barrier(&gc, l->as_ptr[0]);
+    l->as_ptr[0] = value;
+    gc_write_barrier(&gc, l, value);
+    INCREASE_IP();
+    DISPATCH();
   }
 
   case_make_mutable: {
-    Value value = stack_pop(module->stack);
-    Value* v = gc_malloc(&gc, sizeof(Value));
-    memcpy(v, &value, sizeof(Value));
-    HeapValue* l = gc_malloc(&gc, sizeof(HeapValue));
-    l->type = TYPE_MUTABLE;
-    l->length = 1;
-    l->as_ptr = v;
+    SAVE_SP();
+    HeapValue* l = ALLOC_HEAP_VALUE(gc, TYPE_MUTABLE, 1, sizeof(Value));
+    Value value = POP();
+    l->as_ptr[0] = value;
+    gc_write_barrier(&gc, l, value);
     Value mutable = MAKE_PTR(l);
-    stack_push(module->stack, mutable);
-    INCREASE_IP(module);
-    goto *jmp_table[op];
+    PUSH(mutable);
+    INCREASE_IP();
+    DISPATCH();
   }
 
   case_unmut: {
-    Value value = stack_pop(module->stack);
+    Value value = POP();
     ASSERT(get_type(value) == TYPE_MUTABLE, "Invalid mutable type");
-    stack_push(module->stack, GET_MUTABLE(value));
-    INCREASE_IP(module);
-    goto *jmp_table[op];
+    PUSH(GET_MUTABLE(value));
+    INCREASE_IP();
+    DISPATCH();
   }
 
-  case_add: {
-    Value a = stack_pop(module->stack);
-    Value b = stack_pop(module->stack);
+  case_add:
+    ASSERT_FMT(get_type(sp[-1]) == TYPE_INTEGER && get_type(sp[-2]) == TYPE_INTEGER, "Expected integers, got %s and %s", type_of(sp[-1]), type_of(sp[-2]));
+  case_add_int: {
+    Value a = POP();
+    Value b = POP();
 
-    ASSERT_FMT(get_type(a) == TYPE_INTEGER && get_type(b) == TYPE_INTEGER, "Expected integers, got %s and %s", type_of(a), type_of(b));
-
-    stack_push(module->stack, MAKE_INTEGER(a + b));
-    INCREASE_IP(module);
-    goto *jmp_table[op];
+    PUSH(MAKE_INTEGER(a + b));
+    INCREASE_IP();
+    DISPATCH();
   }
 
-  case_sub: {
-    Value a = stack_pop(module->stack);
-    Value b = stack_pop(module->stack);
+  case_sub:
+    ASSERT_FMT(get_type(sp[-1]) == TYPE_INTEGER && get_type(sp[-2]) == TYPE_INTEGER, "Expected integers, got %s and %s", type_of(sp[-1]), type_of(sp[-2]));
+  case_sub_int: {
+    Value a = POP();
+    Value b = POP();
 
-    ASSERT_FMT(get_type(a) == TYPE_INTEGER && get_type(b) == TYPE_INTEGER, "Expected integers, got %s and %s", type_of(a), type_of(b));
-
-    stack_push(module->stack, MAKE_INTEGER(b - a));
-    INCREASE_IP(module);
-    goto *jmp_table[op];
+    PUSH(MAKE_INTEGER(b - a));
+    INCREASE_IP();
+    DISPATCH();
   }
 
   case_return_const: {
-    Frame fr = pop_frame(module);
-    module->stack->stack_pointer = fr.stack_pointer;
-    module->base_pointer = fr.base_ptr;
+    Frame fr = read_frame(values[bp]);
+    module->callstack--;
+    sp = values + fr.stack_pointer;
+    bp = fr.base_ptr;
 
-    stack_push(module->stack, constants[i1]);
+    PUSH(constants[i1]);
 
-    module->pc = fr.instruction_pointer;
+    Value ret = constants[i1];
+    pc = fr.instruction_pointer;
 
-    if (does_return) return constants[i1];
+    if (does_return) {
+      SAVE_STATE();
+      return ret;
+    }
 
-    goto *jmp_table[op];
+    JIT_ENTER();
+    REGISTERS_ENTER();
+    DISPATCH();
   }
 
-  case_add_const: {
-    Value a = stack_pop(module->stack);
+  case_add_const:
+    ASSERT_FMT(get_type(constants[i1]) == TYPE_INTEGER, "Expected integer constant, got %s", type_of(constants[i1]));
+  THREADED_LABEL(case_add_const_verified)
+    ASSERT_FMT(get_type(sp[-1]) == TYPE_INTEGER, "Expected integers, got %s and %s", type_of(sp[-1]), type_of(constants[i1]));
+  case_add_const_int: {
+    Value a = POP();
     Value b = constants[i1];
 
-    ASSERT_FMT(get_type(a) == TYPE_INTEGER && get_type(b) == TYPE_INTEGER, "Expected integers, got %s and %s", type_of(a), type_of(b));
-
-    stack_push(module->stack, MAKE_INTEGER(a + b));
-    INCREASE_IP(module);
-    goto *jmp_table[op];
+    PUSH(MAKE_INTEGER(a + b));
+    INCREASE_IP();
+    DISPATCH();
   }
 
-  case_sub_const: {
-    Value a = stack_pop(module->stack);
+  case_sub_const:
+    ASSERT_FMT(get_type(constants[i1]) == TYPE_INTEGER, "Expected integer constant, got %s", type_of(constants[i1]));
+  THREADED_LABEL(case_sub_const_verified)
+    ASSERT_FMT(get_type(sp[-1]) == TYPE_INTEGER, "Expected integers, got %s and %s", type_of(sp[-1]), type_of(constants[i1]));
+  case_sub_const_int: {
+    Value a = POP();
     Value b = constants[i1];
 
-    ASSERT_FMT(get_type(a) == TYPE_INTEGER && get_type(b) == TYPE_INTEGER, "Expected integers, got %s and %s", type_of(a), type_of(b));
-    stack_push(module->stack, MAKE_INTEGER(a - b));
-    INCREASE_IP(module);
-    goto *jmp_table[op];
+    PUSH(MAKE_INTEGER(a - b));
+    INCREASE_IP();
+    DISPATCH();
   }
 
-  case_jump_else_rel_cmp: {
-    Value a = stack_pop(module->stack);
-    Value b = stack_pop(module->stack);
+  case_jump_else_rel_cmp:
+    ASSERT_FMT(valid_comparison(i2), "Invalid comparison %d", i2);
+  THREADED_LABEL(case_jump_else_rel_cmp_verified) {
+    Value a = POP();
+    Value b = POP();
 
     Value cmp = comparison_table[i2](a, b);
     ASSERT(get_type(cmp) == TYPE_INTEGER, "Expected integer");
 
     if (GET_INT(cmp) == 0) {
-      INCREASE_IP_BY(module, i1);
+      INCREASE_IP_BY(i1);
     } else {
-      INCREASE_IP(module);
+      INCREASE_IP();
     }
 
-    goto *jmp_table[op];
+    DISPATCH();
   }
 
-  case_ijump_else_rel_cmp: {
-    Value a = stack_pop(module->stack);
-    Value b = stack_pop(module->stack);
+  case_ijump_else_rel_cmp:
+    ASSERT_FMT(i1 == 2 || i1 == 5 || i1 == 6, "Invalid integer comparison %d", i1);
+  THREADED_LABEL(case_ijump_else_rel_cmp_verified) {
+    Value a = POP();
+    Value b = POP();
 
     void* icomparison_table[] = {
       UNKNOWN, UNKNOWN, &&icmp_eq, UNKNOWN,
@@ -586,13 +919,13 @@ Value run_interpreter(Deserialized *module, int32_t ipc, bool does_return, int32
     icmp_or: { res = GET_INT(a) | GET_INT(b); goto next; }
 
     next: {
-      INCREASE_IP_BY(module, (uint32_t) res == 0 ? i2 : 1);
-      goto *jmp_table[op];
+      INCREASE_IP_BY((uint32_t) res == 0 ? i2 : 1);
+      DISPATCH();
     }
   }
 
   case_jump_else_rel_cmp_constant: {
-    Value a = stack_pop(module->stack);
+    Value a = POP();
     Value b = constants[i3];
 
     ASSERT(get_type(a) == get_type(b), "Expected integers");
@@ -601,19 +934,31 @@ Value run_interpreter(Deserialized *module, int32_t ipc, bool does_return, int32
     ASSERT(get_type(cmp) == TYPE_INTEGER, "Expected integer");
 
     if (GET_INT(cmp) == 0) {
-      INCREASE_IP_BY(module, i1);
+      INCREASE_IP_BY(i1);
     } else {
-      INCREASE_IP(module);
+      INCREASE_IP();
     }
 
-    goto *jmp_table[op];
+    DISPATCH();
   }
 
-  case_ijump_else_rel_cmp_constant: {
-    Value a = stack_pop(module->stack);
-    Value b = constants[i3];
+  case_switch: {
+    Value value = POP();
+    Switch* s = module->switches[i3];
+    ASSERT_FMT(get_type(value) == s->type, "Cannot switch on %s", type_of(value));
+
+    INCREASE_IP_BY(switch_offset(module, s, value));
+    DISPATCH();
+  }
 
-    ASSERT(get_type(a) == TYPE_INTEGER && get_type(b) == TYPE_INTEGER, "Expected integers");
+  case_ijump_else_rel_cmp_constant:
+    ASSERT_FMT(i2 >= LessThan && i2 <= Or, "Invalid integer comparison %d", i2);
+    ASSERT_FMT(get_type(constants[i3]) == TYPE_INTEGER, "Expected integer constant, got %s", type_of(constants[i3]));
+  THREADED_LABEL(case_ijump_else_rel_cmp_constant_verified)
+    ASSERT(get_type(sp[-1]) == TYPE_INTEGER, "Expected integers");
+  case_ijump_else_rel_cmp_constant_int: {
+    Value a = POP();
+    Value b = constants[i3];
 
     void* icomparison_table[] = {
       &&icmp_cst_lt, &&icmp_cst_gt, &&icmp_cst_eq, &&icmp_cst_neq,
@@ -633,83 +978,178 @@ Value run_interpreter(Deserialized *module, int32_t ipc, bool does_return, int32
     icmp_cst_or: { res = GET_INT(a) | GET_INT(b); goto next_cst; }
 
     next_cst: {
-      INCREASE_IP_BY(module, (uint32_t) res == 0 ? i1 : 1);
-      goto *jmp_table[op];
+      INCREASE_IP_BY((uint32_t) res == 0 ? i1 : 1);
+      DISPATCH();
     }
   }
 
-  case_call_global: {
-    Value callee = module->stack->values[i1];
-
-    ASSERT(IS_FUN(callee) || IS_PTR(callee), "Invalid callee type");
+  case_make_and_store_lambda: {
+    int32_t new_pc = pc + 4;
+    Value lambda = MAKE_FUNCTION(new_pc, i3);
 
-    interpreter_table[(callee & MASK_SIGNATURE) == SIGNATURE_FUNCTION](module, callee, i2);
+    values[i1] = lambda;
 
-    goto *jmp_table[op];
+    INCREASE_IP_BY(i2 + 1);
+    DISPATCH();
   }
 
-  case_call_local: {
-    int32_t locals = module->base_pointer;
+  case_mul:
+    ASSERT_FMT(get_type(sp[-1]) == TYPE_INTEGER && get_type(sp[-2]) == TYPE_INTEGER, "Expected integers, got %s and %s", type_of(sp[-1]), type_of(sp[-2]));
+  case_mul_int: {
+    Value a = POP();
+    Value b = POP();
 
-    Value callee = module->stack->values[locals + i1];
-
-    ASSERT(IS_FUN(callee) || IS_PTR(callee), "Invalid callee type");
+    PUSH(MAKE_INTEGER(a * b));
+    INCREASE_IP();
+    DISPATCH();
+  }
 
-    interpreter_table[(callee & MASK_SIGNATURE) == SIGNATURE_FUNCTION](module, callee, i2);
+  case_mul_const:
+    ASSERT_FMT(get_type(constants[i1]) == TYPE_INTEGER, "Expected integer constant, got %s", type_of(constants[i1]));
+  THREADED_LABEL(case_mul_const_verified)
+    ASSERT_FMT(get_type(sp[-1]) == TYPE_INTEGER, "Expected integers, got %s and %s", type_of(sp[-1]), type_of(constants[i1]));
+  case_mul_const_int: {
+    Value a = POP();
+    Value b = constants[i1];
 
-    goto *jmp_table[op];
+    PUSH(MAKE_INTEGER(a * b));
+    INCREASE_IP();
+    DISPATCH();
   }
 
-  case_make_and_store_lambda: {
-    int32_t new_pc = module->pc + 4;
-    Value lambda = MAKE_FUNCTION(new_pc, i3);
-
-    module->stack->values[i1] = lambda;
+  case_return_unit: {
+    Frame fr = read_frame(values[bp]);
+    module->callstack--;
+    sp = values + fr.stack_pointer;
+    bp = fr.base_ptr;
+
+    SAVE_SP();
+    gc_nursery_reserve(&gc, gc_young_footprint(&gc, HEAP_VALUE_SIZE(sizeof(Value) * 3)) +
+                            2 * gc_young_footprint(&gc, HEAP_VALUE_SIZE(sizeof("unit"))));
+    HeapValue* l = ALLOC_HEAP_VALUE(gc, TYPE_LIST, 3, sizeof(Value) * 3);
+    l->as_ptr[0] = MAKE_SPECIAL();
+    l->as_ptr[1] = MAKE_STRING(module->gc, "unit");
+    l->as_ptr[2] = MAKE_STRING(module->gc, "unit");
+    gc_list_barrier(&gc, l);
+
+    Value unit = MAKE_PTR(l);
+    PUSH(unit);
+
+    pc = fr.instruction_pointer;
+
+    if (does_return) {
+      SAVE_STATE();
+      return unit;
+    }
 
-    INCREASE_IP_BY(module, i2 + 1);
-    goto *jmp_table[op];
+    JIT_ENTER();
+    REGISTERS_ENTER();
+    DISPATCH();
   }
 
-  case_mul: {
-    Value a = stack_pop(module->stack);
-    Value b = stack_pop(module->stack);
+  // Superinstructions, see superinstructions.c
 
-    ASSERT_FMT(get_type(a) == TYPE_INTEGER && get_type(b) == TYPE_INTEGER, "Expected integers, got %s and %s", type_of(a), type_of(b));
+  case_load_local_load_local_add:
+    ASSERT_FMT(get_type(values[bp + i1]) == TYPE_INTEGER && get_type(values[bp + in(1, 1)]) == TYPE_INTEGER,
+               "Expected integers, got %s and %s", type_of(values[bp + i1]), type_of(values[bp + in(1, 1)]));
+  case_load_local_load_local_add_int: {
+    Value a = values[bp + i1];
+    Value b = values[bp + in(1, 1)];
 
-    stack_push(module->stack, MAKE_INTEGER(a * b));
-    INCREASE_IP(module);
-    goto *jmp_table[op];
+    PUSH(MAKE_INTEGER(a + b));
+    INCREASE_IP_BY(3);
+    DISPATCH();
   }
 
-  case_mul_const: {
-    Value a = stack_pop(module->stack);
-    Value b = constants[i1];
+  case_load_local_sub_const:
+    ASSERT_FMT(get_type(constants[in(1, 1)]) == TYPE_INTEGER, "Expected integer constant, got %s", type_of(constants[in(1, 1)]));
+  THREADED_LABEL(case_load_local_sub_const_verified)
+    ASSERT_FMT(get_type(values[bp + i1]) == TYPE_INTEGER, "Expected integers, got %s and %s", type_of(values[bp + i1]), type_of(constants[in(1, 1)]));
+  case_load_local_sub_const_int: {
+    Value a = values[bp + i1];
+    Value b = constants[in(1, 1)];
+
+    PUSH(MAKE_INTEGER(a - b));
+    INCREASE_IP_BY(2);
+    DISPATCH();
+  }
 
-    ASSERT_FMT(get_type(a) == TYPE_INTEGER && get_type(b) == TYPE_INTEGER, "Expected integers, got %s and %s", type_of(a), type_of(b));
+  case_load_local_return: {
+    PUSH(values[bp + i1]);
+    INCREASE_IP();
+    goto case_return;
+  }
+
+  case_load_local_ijump_else_rel_cmp_constant:
+    ASSERT_FMT(in(1, 2) >= LessThan && in(1, 2) <= Or, "Invalid integer comparison %d", in(1, 2));
+    ASSERT_FMT(get_type(constants[in(1, 3)]) == TYPE_INTEGER, "Expected integer constant, got %s", type_of(constants[in(1, 3)]));
+  THREADED_LABEL(case_load_local_ijump_else_rel_cmp_constant_verified)
+    ASSERT(get_type(values[bp + i1]) == TYPE_INTEGER, "Expected integers");
+  case_load_local_ijump_else_rel_cmp_constant_int: {
+    Value a = values[bp + i1];
+    Value b = constants[in(1, 3)];
+
+    uint32_t res = icompare(in(1, 2), GET_INT(a), GET_INT(b));
+    INCREASE_IP_BY(res == 0 ? 1 + in(1, 1) : 2);
+    DISPATCH();
+  }
 
-    stack_push(module->stack, MAKE_INTEGER(a * b));
-    INCREASE_IP(module);
+  case_load_local_call_global: {
+    PUSH(values[bp + i1]);
+    INCREASE_IP();
+    // The call may be a tail call, or have been quickened
+#if DIRECT_THREADING
+    goto *code[pc >> 2].handler;
+#else
     goto *jmp_table[op];
+#endif
   }
 
-  case_return_unit: {
-    Frame fr = pop_frame(module);
-    module->stack->stack_pointer = fr.stack_pointer;
-    module->base_pointer = fr.base_ptr;
+  case_load_global_list_get: {
+    Value list = values[i1];
+    uint32_t idx = GET_INT(in(1, 1));
+    ASSERT_FMT(get_type(list) == TYPE_LIST, "Invalid list type at IPC %d", pc / 4 + 1);
+    HeapValue* l = GET_PTR(list);
+    ASSERT(idx < l->length, "Index out of bounds");
+    PUSH(list_element(l, idx));
+    INCREASE_IP_BY(2);
+    DISPATCH();
+  }
 
-    Value* values = gc_malloc(&gc, sizeof(Value) * 3);
-    values[0] = MAKE_SPECIAL();
-    values[1] = MAKE_STRING(module->gc, "unit");
-    values[2] = MAKE_STRING(module->gc, "unit");
+  case_load_global_ijump_else_rel_cmp_constant:
+    ASSERT_FMT(in(1, 2) >= LessThan && in(1, 2) <= Or, "Invalid integer comparison %d", in(1, 2));
+    ASSERT_FMT(get_type(constants[in(1, 3)]) == TYPE_INTEGER, "Expected integer constant, got %s", type_of(constants[in(1, 3)]));
+  THREADED_LABEL(case_load_global_ijump_else_rel_cmp_constant_verified) {
+    Value a = values[i1];
+    Value b = constants[in(1, 3)];
 
-    Value unit = MAKE_LIST(module->gc, values, 3);
-    stack_push(module->stack, unit);
+    ASSERT(get_type(a) == TYPE_INTEGER, "Expected integers");
 
-    module->pc = fr.instruction_pointer;
+    uint32_t res = icompare(in(1, 2), GET_INT(a), GET_INT(b));
+    INCREASE_IP_BY(res == 0 ? 1 + in(1, 1) : 2);
+    DISPATCH();
+  }
 
-    if (does_return) return unit;
+  case_load_global_add_const_store_global:
+    ASSERT_FMT(get_type(constants[in(1, 1)]) == TYPE_INTEGER, "Expected integer constant, got %s", type_of(constants[in(1, 1)]));
+  THREADED_LABEL(case_load_global_add_const_store_global_verified) {
+    Value a = values[i1];
+    Value b = constants[in(1, 1)];
 
-    goto *jmp_table[op];
+    ASSERT_FMT(get_type(a) == TYPE_INTEGER, "Expected integers, got %s and %s", type_of(a), type_of(b));
+
+    int32_t global = in(2, 1);
+    gc_value_barrier(&gc, values[global]);
+    values[global] = MAKE_INTEGER(a + b);
+    INCREASE_IP_BY(3);
+    DISPATCH();
+  }
+
+  case_store_global_jump_rel: {
+    gc_value_barrier(&gc, values[i1]);
+    values[i1] = POP();
+    INCREASE_IP_BY(1 + in(1, 1));
+    DISPATCH();
   }
 
   case_unknown: {
@@ -717,3 +1157,11 @@ Value run_interpreter(Deserialized *module, int32_t ipc, bool does_return, int32
     return 0;
   }
 }
+
+Value run_interpreter(Deserialized *module, int32_t ipc, bool does_return, int32_t current_callstack) {
+#if TAIL_CALL_INTERPRETER
+  return run_interpreter_tail(module, ipc, does_return, current_callstack);
+#else
+  return run_interpreter_loop(module, ipc, does_return, current_callstack);
+#endif
+}
@@ -0,0 +1,512 @@
+#include <jit.h>
+
+#if JIT
+
+#include <bytecode.h>
+#include <interpreter.h>
+#include <switches.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Compiled code keeps the VM state in callee-saved registers:
+//   rbx  stack pointer, the next free slot
+//   r12  locals, the stack at the base pointer
+//   r13  globals, the bottom of the stack
+//   r14  constants
+// Each instruction is a template reading its operands from the stack, and
+// leaving the stack as the interpreter would. An instruction without a
+// template, or one whose operands have unexpected types, ends the compiled
+// code: the program counter of that instruction is returned, with the stack
+// as it was before it, and the interpreter runs it instead.
+//
+// A compiled function is laid out, after its JitRegion, as
+//   prologue   saves registers, loads the state, jumps to the entry
+//   epilogue   returns the program counter in eax and the stack pointer
+//   body       one template per instruction
+//   exits      one stub per program counter compiled code may return
+
+uint32_t jit_threshold = 1000;
+
+enum { RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSI = 6, RDI = 7, R12 = 12, R13 = 13, R14 = 14 };
+
+// Condition codes of jcc
+enum { CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_BE = 0x6, CC_A = 0x7 };
+
+typedef struct {
+  size_t position;  // of the rel32 to patch
+  size_t from;      // offset the rel32 is relative to
+  int32_t target;   // instruction index
+  bool exit;        // return to the interpreter even if the target is compiled
+} Fixup;
+
+typedef struct {
+  uint8_t *bytes;
+  size_t size;
+  size_t capacity;
+
+  int32_t first, end;  // instructions of the function
+  int32_t *labels;     // offset of each instruction, -1 when not emitted
+  bool *templates;     // whether the instruction was compiled or exits
+  size_t epilogue;
+
+  Fixup *fixups;
+  size_t fixup_count;
+  size_t fixup_capacity;
+} Compiler;
+
+static void emit(Compiler *c, const uint8_t *bytes, size_t n) {
+  if (c->size + n > c->capacity) {
+    c->capacity = c->capacity * 2 + n;
+    c->bytes = realloc(c->bytes, c->capacity);
+  }
+  memcpy(c->bytes + c->size, bytes, n);
+  c->size += n;
+}
+
+#define EMIT(c, ...) \
+  emit((c), (const uint8_t[]) { __VA_ARGS__ }, sizeof((const uint8_t[]) { __VA_ARGS__ }))
+
+static void emit32(Compiler *c, int32_t x) { emit(c, (const uint8_t *) &x, 4); }
+static void emit64(Compiler *c, uint64_t x) { emit(c, (const uint8_t *) &x, 8); }
+
+static void patch32(Compiler *c, size_t position, int32_t x) { memcpy(c->bytes + position, &x, 4); }
+
+// mov reg, [base + disp]
+static void emit_load(Compiler *c, int reg, int base, int32_t disp) {
+  EMIT(c, 0x48 | (base >= 8), 0x8B, 0x80 | (reg << 3) | (base & 7));
+  if ((base & 7) == 4) EMIT(c, 0x24);  // rsp and r12 need a SIB byte
+  emit32(c, disp);
+}
+
+// mov [base + disp], reg
+static void emit_store(Compiler *c, int reg, int base, int32_t disp) {
+  EMIT(c, 0x48 | (base >= 8), 0x89, 0x80 | (reg << 3) | (base & 7));
+  if ((base & 7) == 4) EMIT(c, 0x24);
+  emit32(c, disp);
+}
+
+// movabs reg, imm64
+static void emit_mov64(Compiler *c, int reg, uint64_t x) {
+  EMIT(c, 0x48, 0xB8 + reg);
+  emit64(c, x);
+}
+
+static void emit_push_rax(Compiler *c) {
+  emit_store(c, RAX, RBX, 0);
+  EMIT(c, 0x48, 0x83, 0xC3, 8);  // add rbx, 8
+}
+
+static void emit_drop(Compiler *c, int8_t count) {
+  EMIT(c, 0x48, 0x83, 0xEB, (uint8_t) (count * 8));  // sub rbx, 8 * count
+}
+
+static void emit_relative(Compiler *c, int32_t target, bool exit, size_t from) {
+  if (c->fixup_count == c->fixup_capacity) {
+    c->fixup_capacity = c->fixup_capacity * 2 + 16;
+    c->fixups = realloc(c->fixups, c->fixup_capacity * sizeof(Fixup));
+  }
+  c->fixups[c->fixup_count++] = (Fixup) { c->size, from, target, exit };
+  emit32(c, 0);
+}
+
+// rel32 of a jump, from the end of the instruction
+static void emit_fixup(Compiler *c, int32_t target, bool exit) {
+  emit_relative(c, target, exit, c->size + 4);
+}
+
+static void emit_jump(Compiler *c, int32_t target) {
+  EMIT(c, 0xE9);
+  emit_fixup(c, target, false);
+}
+
+static void emit_jcc(Compiler *c, int cc, int32_t target) {
+  EMIT(c, 0x0F, 0x80 | cc);
+  emit_fixup(c, target, false);
+}
+
+// Leaves compiled code at instruction `i` if `reg` is not an integer
+static void emit_check_int(Compiler *c, int reg, int32_t i) {
+  EMIT(c, 0x48, 0x89, 0xC1 | (reg << 3));  // mov rcx, reg
+  EMIT(c, 0x48, 0xC1, 0xE9, 48);           // shr rcx, 48
+  EMIT(c, 0x81, 0xF9);                     // cmp ecx, imm32
+  emit32(c, (int32_t) (SIGNATURE_INTEGER >> 48));
+  EMIT(c, 0x0F, 0x80 | CC_NE);
+  emit_fixup(c, i, true);
+}
+
+// Tags the 32 bits of eax as an integer value
+static void emit_tag_int(Compiler *c) {
+  emit_mov64(c, RCX, SIGNATURE_INTEGER);
+  EMIT(c, 0x48, 0x09, 0xC8);  // or rax, rcx
+}
+
+// mov eax, pc; jmp epilogue
+static void emit_exit(Compiler *c, int32_t i) {
+  EMIT(c, 0xB8);
+  emit32(c, i * 4);
+  EMIT(c, 0xE9);
+  emit32(c, (int32_t) (c->epilogue - (c->size + 4)));
+}
+
+static void emit_call(Compiler *c, void *function) {
+  emit_mov64(c, RAX, (uint64_t) (uintptr_t) function);
+  EMIT(c, 0xFF, 0xD0);  // call rax
+}
+
+static bool is_int_constant(Value value) {
+  return (value & MASK_SIGNATURE) == SIGNATURE_INTEGER;
+}
+
+// Superinstructions are compiled as their first instruction, the following
+// ones are still in place.
+static Opcode unfused(Opcode op) {
+  switch (op) {
+    case OP_LoadLocalLoadLocalAdd: case OP_LoadLocalSubConst:
+    case OP_LoadLocalReturn: case OP_LoadLocalIJumpElseRelCmpConst:
+    case OP_LoadLocalCallGlobal: case OP_LoadLocalLoadLocalAddInt:
+    case OP_LoadLocalSubConstInt: case OP_LoadLocalIJumpElseRelCmpConstInt:
+      return OP_LoadLocal;
+    case OP_LoadGlobalListGet: case OP_LoadGlobalIJumpElseRelCmpConst:
+    case OP_LoadGlobalAddConstStoreGlobal:
+      return OP_LoadGlobal;
+    case OP_StoreGlobalJumpRel:
+      return OP_StoreGlobal;
+    default:
+      return op;
+  }
+}
+
+// Integer variants are compiled as their generic instruction, without
+// checking the types of operands.
+static Opcode generic(Opcode op) {
+  switch (op) {
+    case OP_AddInt: return OP_Add;
+    case OP_SubInt: return OP_Sub;
+    case OP_MulInt: return OP_Mul;
+    case OP_AddConstInt: return OP_AddConst;
+    case OP_SubConstInt: return OP_SubConst;
+    case OP_MulConstInt: return OP_MulConst;
+    case OP_IJumpElseRelCmpConstInt: return OP_IJumpElseRelCmpConst;
+    default: return op;
+  }
+}
+
+// Slot of the jump table of a Switch, -1 if `value` is not of the type of its
+// keys
+static int32_t switch_target(Deserialized *module, Switch *s, Value value) {
+  if (get_type(value) != s->type) return -1;
+  return switch_slot(module, s, value);
+}
+
+// Emits the template of instruction `i`, or nothing and returns false if it
+// has none.
+static bool compile_instruction(Compiler *c, Deserialized *module, int32_t i) {
+  int32_t *instr = &module->instrs[i * 4];
+  int32_t i1 = instr[1], i2 = instr[2], i3 = instr[3];
+  Constants constants = module->constants;
+  Opcode op = generic(unfused(instr[0]));
+  bool checked = op == unfused(instr[0]);
+
+  switch (op) {
+    case OP_LoadLocal:
+      emit_load(c, RAX, R12, i1 * 8);
+      emit_push_rax(c);
+      return true;
+
+    case OP_StoreLocal:
+      emit_drop(c, 1);
+      emit_load(c, RAX, RBX, 0);
+      emit_store(c, RAX, R12, i1 * 8);
+      return true;
+
+    case OP_LoadConstant:
+      emit_load(c, RAX, R14, i1 * 8);
+      emit_push_rax(c);
+      return true;
+
+    case OP_LoadGlobal:
+      emit_load(c, RAX, R13, i1 * 8);
+      emit_push_rax(c);
+      return true;
+
+    case OP_Special:
+      emit_mov64(c, RAX, MAKE_SPECIAL());
+      emit_push_rax(c);
+      return true;
+
+    case OP_Add: case OP_Sub: case OP_Mul: {
+      emit_load(c, RAX, RBX, -16);
+      emit_load(c, RDX, RBX, -8);
+      if (checked) {
+        emit_check_int(c, RAX, i);
+        emit_check_int(c, RDX, i);
+      }
+      if (op == OP_Add) EMIT(c, 0x01, 0xD0);          // add eax, edx
+      else if (op == OP_Sub) EMIT(c, 0x29, 0xD0);     // sub eax, edx
+      else EMIT(c, 0x0F, 0xAF, 0xC2);                 // imul eax, edx
+      emit_tag_int(c);
+      emit_store(c, RAX, RBX, -16);
+      emit_drop(c, 1);
+      return true;
+    }
+
+    case OP_AddConst: case OP_SubConst: case OP_MulConst: {
+      Value b = constants[i1];
+      if (!is_int_constant(b)) return false;
+
+      emit_load(c, RAX, RBX, -8);
+      if (checked) emit_check_int(c, RAX, i);
+      if (op == OP_AddConst) EMIT(c, 0x05);           // add eax, imm32
+      else if (op == OP_SubConst) EMIT(c, 0x2D);      // sub eax, imm32
+      else EMIT(c, 0x69, 0xC0);                       // imul eax, eax, imm32
+      emit32(c, (int32_t) GET_INT(b));
+      emit_tag_int(c);
+      emit_store(c, RAX, RBX, -8);
+      return true;
+    }
+
+    case OP_JumpRel:
+      emit_jump(c, i + i1);
+      return true;
+
+    case OP_JumpElseRel:
+      emit_load(c, RAX, RBX, -8);
+      emit_check_int(c, RAX, i);
+      emit_drop(c, 1);
+      EMIT(c, 0x85, 0xC0);  // test eax, eax
+      emit_jcc(c, CC_E, i + i1);
+      return true;
+
+    case OP_IJumpElseRelCmp: {
+      // Indexed like comparison_table, only equality, and and or are defined
+      if (i1 != 2 && i1 != 5 && i1 != 6) return false;
+
+      emit_load(c, RAX, RBX, -8);
+      emit_load(c, RDX, RBX, -16);
+      emit_drop(c, 2);
+      if (i1 == 2) {
+        EMIT(c, 0x39, 0xD0);  // cmp eax, edx
+        emit_jcc(c, CC_NE, i + i2);
+      } else if (i1 == 5) {
+        EMIT(c, 0x85, 0xD0);  // test eax, edx
+        emit_jcc(c, CC_E, i + i2);
+      } else {
+        EMIT(c, 0x09, 0xD0);  // or eax, edx
+        emit_jcc(c, CC_E, i + i2);
+      }
+      return true;
+    }
+
+    case OP_IJumpElseRelCmpConst: {
+      Value b = constants[i3];
+      if (!is_int_constant(b) || i2 < LessThan || i2 > Or) return false;
+      int32_t y = (int32_t) GET_INT(b);
+
+      emit_load(c, RAX, RBX, -8);
+      if (checked) emit_check_int(c, RAX, i);
+      emit_drop(c, 1);
+
+      // Jumps when the comparison is false, unsigned as in the interpreter
+      static const int negated[] = {
+        [LessThan] = CC_AE, [GreaterThan] = CC_BE, [EqualTo] = CC_NE,
+        [NotEqualTo] = CC_E, [LessThanOrEqualTo] = CC_A, [GreaterThanOrEqualTo] = CC_B };
+
+      if (i2 == And) {
+        EMIT(c, 0xA9);  // test eax, imm32
+        emit32(c, y);
+        emit_jcc(c, CC_E, i + i1);
+      } else if (i2 == Or) {
+        if (y != 0) return true;
+        EMIT(c, 0x85, 0xC0);  // test eax, eax
+        emit_jcc(c, CC_E, i + i1);
+      } else {
+        EMIT(c, 0x3D);  // cmp eax, imm32
+        emit32(c, y);
+        emit_jcc(c, negated[i2], i + i1);
+      }
+      return true;
+    }
+
+    // Comparisons of other types call back into the interpreter's functions
+
+    case OP_Compare: {
+      if (!valid_comparison(i1)) return false;
+
+      emit_load(c, RDI, RBX, -16);
+      emit_load(c, RSI, RBX, -8);
+      emit_call(c, comparison_table[i1]);
+      emit_store(c, RAX, RBX, -16);
+      emit_drop(c, 1);
+      return true;
+    }
+
+    case OP_JumpElseRelCmp: {
+      if (!valid_comparison(i2)) return false;
+
+      emit_load(c, RDI, RBX, -8);
+      emit_load(c, RSI, RBX, -16);
+      emit_call(c, comparison_table[i2]);
+      emit_drop(c, 2);
+      EMIT(c, 0x85, 0xC0);  // test eax, eax
+      emit_jcc(c, CC_E, i + i1);
+      return true;
+    }
+
+    case OP_JumpElseRelCmpConst:
+      emit_load(c, RDI, RBX, -8);
+      emit_mov64(c, RSI, constants[i3]);
+      emit_call(c, compare_eq);
+      emit_drop(c, 1);
+      EMIT(c, 0x85, 0xC0);  // test eax, eax
+      emit_jcc(c, CC_E, i + i1);
+      return true;
+
+    // The slot is looked up out of line, then jumped through a table of
+    // offsets from its start, which follows the jump
+    case OP_Switch: {
+      Switch *s = module->switches[i3];
+      emit_mov64(c, RDI, (uint64_t) (uintptr_t) module);
+      emit_mov64(c, RSI, (uint64_t) (uintptr_t) s);
+      emit_load(c, RDX, RBX, -8);
+      emit_call(c, switch_target);
+      EMIT(c, 0x83, 0xF8, 0xFF);  // cmp eax, -1
+      EMIT(c, 0x0F, 0x80 | CC_E);
+      emit_fixup(c, i, true);
+      emit_drop(c, 1);
+
+      EMIT(c, 0x48, 0x8D, 0x0D);  // lea rcx, [rip + table]
+      size_t lea = c->size;
+      emit32(c, 0);
+      EMIT(c, 0x48, 0x63, 0x04, 0x81);  // movsxd rax, dword [rcx + rax * 4]
+      EMIT(c, 0x48, 0x01, 0xC8);        // add rax, rcx
+      EMIT(c, 0xFF, 0xE0);              // jmp rax
+
+      size_t table = c->size;
+      patch32(c, lea, (int32_t) (table - (lea + 4)));
+      for (int32_t k = 0; k < switch_slots(s); k++) emit_relative(c, i + switch_slot_offset(s, k), false, table);
+      return true;
+    }
+
+    default:
+      return false;
+  }
+}
+
+Jit *jit_new(Deserialized *module) {
+  Jit *jit = gc_malloc(&module->gc, sizeof(Jit));
+  jit->regions = NULL;
+  jit->calls = gc_calloc(&module->gc, module->instr_count, sizeof(uint32_t));
+  jit->entries = gc_calloc(&module->gc, module->instr_count, sizeof(JitEntry));
+  return jit;
+}
+
+void jit_compile(Deserialized *module, int32_t ipc) {
+  Jit *jit = module->jit;
+  int32_t *bytecode = module->instrs;
+  int32_t first = ipc / 4;
+  if (first <= 0 || first >= module->instr_count || jit->entries[first].code != NULL) return;
+
+  // The body of a function follows the instruction creating its closure
+  int32_t length;
+  switch (bytecode[(first - 1) * 4]) {
+    case OP_MakeLambda: length = bytecode[(first - 1) * 4 + 1]; break;
+    case OP_MakeAndStoreLambda: length = bytecode[(first - 1) * 4 + 2]; break;
+    default: return;
+  }
+
+  Compiler c = { 0 };
+  c.first = first;
+  c.end = first + length < module->instr_count ? first + length : module->instr_count;
+  c.labels = malloc((c.end - c.first) * sizeof(int32_t));
+  c.templates = calloc(c.end - c.first, sizeof(bool));
+
+  // push rbx; push r12; push r13; push r14, and rbp which only keeps the
+  // stack aligned for calls
+  EMIT(&c, 0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x55);
+  EMIT(&c, 0x48, 0x89, 0xF3);  // mov rbx, rsi
+  EMIT(&c, 0x49, 0x89, 0xD4);  // mov r12, rdx
+  EMIT(&c, 0x49, 0x89, 0xFD);  // mov r13, rdi
+  EMIT(&c, 0x49, 0x89, 0xCE);  // mov r14, rcx
+  EMIT(&c, 0x41, 0xFF, 0xE0);  // jmp r8
+
+  c.epilogue = c.size;
+  EMIT(&c, 0x48, 0x89, 0xDA);  // mov rdx, rbx
+  EMIT(&c, 0x5D, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3);
+
+  bool compiled = false;
+  for (int32_t i = c.first; i < c.end; i++) {
+    c.labels[i - c.first] = (int32_t) c.size;
+    if (compile_instruction(&c, module, i)) {
+      c.templates[i - c.first] = compiled = true;
+      continue;
+    }
+
+    emit_exit(&c, i);
+
+    // Nested functions are compiled on their own
+    int32_t op = bytecode[i * 4];
+    int32_t nested = op == OP_MakeLambda ? bytecode[i * 4 + 1]
+                   : op == OP_MakeAndStoreLambda ? bytecode[i * 4 + 2]
+                   : 0;
+    for (int32_t j = 1; j <= nested && i + j < c.end; j++) c.labels[i + j - c.first] = -1;
+    i += nested;
+  }
+
+  for (size_t f = 0; f < c.fixup_count; f++) {
+    Fixup fixup = c.fixups[f];
+    bool inside = fixup.target >= c.first && fixup.target < c.end && c.labels[fixup.target - c.first] >= 0;
+
+    size_t target;
+    if (inside && !fixup.exit) {
+      target = c.labels[fixup.target - c.first];
+    } else {
+      target = c.size;
+      emit_exit(&c, fixup.target);
+    }
+    patch32(&c, fixup.position, (int32_t) (target - fixup.from));
+  }
+
+  if (compiled) {
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t size = (sizeof(JitRegion) + c.size + page - 1) / page * page;
+    JitRegion *region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (region != MAP_FAILED) {
+      uint8_t *code = (uint8_t *) (region + 1);
+      *region = (JitRegion) { jit->regions, size };
+      memcpy(code, c.bytes, c.size);
+      if (mprotect(region, size, PROT_READ | PROT_EXEC) == 0) {
+        jit->regions = region;
+
+        // Entries are only set for instructions with a template, so that
+        // entering compiled code always makes progress.
+        for (int32_t i = c.first; i < c.end; i++) {
+          if (!c.templates[i - c.first]) continue;
+          jit->entries[i].enter = (JitCode) code;
+          jit->entries[i].code = code + c.labels[i - c.first];
+        }
+      } else {
+        munmap(region, size);
+      }
+    }
+  }
+
+  free(c.bytes);
+  free(c.labels);
+  free(c.templates);
+  free(c.fixups);
+}
+
+void jit_free(Deserialized *module) {
+  if (module->jit == NULL) return;
+
+  JitRegion *region = module->jit->regions;
+  while (region != NULL) {
+    JitRegion *next = region->next;
+    munmap(region, region->size);
+    region = next;
+  }
+  module->jit = NULL;
+}
+
+#endif  // JIT
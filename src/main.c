@@ -2,8 +2,15 @@
 #include <core/debug.h>
 #include <core/error.h>
 #include <core/library.h>
+#include <constructors.h>
 #include <deserializer.h>
+#include <inference.h>
 #include <interpreter.h>
+#include <jit.h>
+#include <registers.h>
+#include <superinstructions.h>
+#include <switches.h>
+#include <verifier.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
@@ -71,17 +78,114 @@ static inline struct Env get_mod_path() {
   return env;
 }
 
+// Where to dump the collector statistics at exit, if anywhere.
+static char* gc_stats_path = NULL;
+
+static void write_gc_stats(void) {
+  if (gc_stats_path == NULL) return;
+  if (!gc_stats_write(&gc, gc_stats_path)) {
+    fprintf(stderr, "Could not write GC statistics to %s\n", gc_stats_path);
+  }
+  gc_stats_path = NULL;
+}
+
+// Parses a byte count with an optional k, m or g suffix.
+static size_t parse_size(const char* name, const char* text) {
+  char* end;
+  double size = strtod(text, &end);
+  switch (*end) {
+    case 'k': case 'K': size *= 1024; end++; break;
+    case 'm': case 'M': size *= 1024 * 1024; end++; break;
+    case 'g': case 'G': size *= 1024 * 1024 * 1024; end++; break;
+  }
+  if (end == text || *end != '\0' || size < 0) {
+    THROW_FMT("Invalid size for %s: %s", name, text);
+  }
+  return (size_t) size;
+}
+
+static double parse_factor(const char* name, const char* text) {
+  char* end;
+  double factor = strtod(text, &end);
+  if (end == text || *end != '\0' || factor <= 1.0) {
+    THROW_FMT("Invalid growth factor for %s: %s", name, text);
+  }
+  return factor;
+}
+
+struct HeapOptions {
+  size_t initial;
+  size_t max;
+  double growth;
+};
+
+// Heap sizing from the environment, then from the options preceding the
+// file, which are removed from the arguments passed on to the program.
+static struct HeapOptions get_heap_options(int* argc, char*** argv_) {
+  char** argv = *argv_;
+  struct HeapOptions heap = { 16 * 1024 * 1024, 0, 2.0 };
+
+  char* env;
+  if ((env = getenv("PLUME_HEAP_INITIAL"))) heap.initial = parse_size("PLUME_HEAP_INITIAL", env);
+  if ((env = getenv("PLUME_HEAP_MAX"))) heap.max = parse_size("PLUME_HEAP_MAX", env);
+  if ((env = getenv("PLUME_HEAP_GROWTH"))) heap.growth = parse_factor("PLUME_HEAP_GROWTH", env);
+
+  int i = 1;
+  for (; i < *argc && strncmp(argv[i], "--", 2) == 0; i++) {
+    char* arg = argv[i];
+    char* value = strchr(arg, '=');
+    if (value == NULL) THROW_FMT("Missing value for option %s", arg);
+    value++;
+
+    if (strncmp(arg, "--heap-initial=", 15) == 0) {
+      heap.initial = parse_size("--heap-initial", value);
+    } else if (strncmp(arg, "--heap-max=", 11) == 0) {
+      heap.max = parse_size("--heap-max", value);
+    } else if (strncmp(arg, "--heap-growth=", 14) == 0) {
+      heap.growth = parse_factor("--heap-growth", value);
+    } else {
+      THROW_FMT("Unknown option %s", arg);
+    }
+  }
+
+  // Keep the program name in front of the file.
+  argv[i - 1] = argv[0];
+  *argv_ = argv + i - 1;
+  *argc -= i - 1;
+  return heap;
+}
+
 int main(int argc, char** argv) {
 #if DEBUG
   unsigned long long start = clock_gettime_nsec_np(CLOCK_MONOTONIC);
 #endif
 
-  #define min_gc_value 32768 * sizeof(Value)
+  struct HeapOptions heap = get_heap_options(&argc, &argv);
+
+  // The allocation map only indexes objects too large for the slabs, the
+  // heap policy decides when to collect.
+  gc_start_ext(&gc, &argc, 4096, 4096, 0.0, 4, 0.0);
+  gc_set_heap_policy(&gc, heap.initial, heap.max, heap.growth);
+
+  // Incremental marking, with the target pause per slice in milliseconds.
+  char* gc_pause = getenv("PLUME_GC_PAUSE_MS");
+  if (gc_pause != NULL) gc_set_pause_target(&gc, atof(gc_pause));
 
-  gc_start_ext(&gc, &argc, 
-    min_gc_value, min_gc_value, 0.0, 4, 0.0);
+  // Number of threads marking the heap in stop-the-world collections.
+  char* gc_threads = getenv("PLUME_GC_THREADS");
+  if (gc_threads != NULL) gc_set_mark_threads(&gc, strtoul(gc_threads, NULL, 10));
 
-  if (argc < 2) THROW_FMT("Usage: %s <file>\n", argv[0]);
+#if JIT
+  // Calls before a function is compiled, 0 to disable the JIT.
+  char* jit = getenv("PLUME_JIT_THRESHOLD");
+  if (jit != NULL) jit_threshold = strtoul(jit, NULL, 10);
+#endif
+
+  // Collector statistics as JSON, written however the program exits.
+  gc_stats_path = getenv("PLUME_GC_STATS");
+  if (gc_stats_path != NULL) atexit(write_gc_stats);
+
+  if (argc < 2) THROW_FMT("Usage: %s [--heap-initial=SIZE] [--heap-max=SIZE] [--heap-growth=FACTOR] <file>\n", argv[0]);
   FILE* file = fopen(argv[1], "rb");
 
   Value* values = gc_malloc(&gc, sizeof(Value) * argc);
@@ -102,12 +206,26 @@ int main(int argc, char** argv) {
   }
 
   Deserialized des = deserialize(gc, file);
+  tag_constructors(&des);
+  build_switches(&des);
+  des.verified = verify_module(&des);
+  if (des.verified) {
+    specialize_integers(&des);
+#if REGISTER_TIER
+    translate_registers(&des);
+#endif
+  }
+  fuse_superinstructions(des.instrs, des.instr_count);
 
   fclose(file);
 
   des.argc = argc;
   des.argv = values;
   des.handles = gc_malloc(&gc, des.libraries.num_libraries * sizeof(void*));
+  gc_add_root(&gc, module_mark_roots, &des);
+  gc_add_root(&gc, nursery_mark_roots, NULL);
+  gc_nursery_set_scavenger(&gc, module_scavenge, &des);
+  gc_set_tracer(&gc, gc_trace_heap_value);
 
   struct Env res = get_std_path();
   struct Env mod = get_mod_path();
@@ -171,6 +289,11 @@ int main(int argc, char** argv) {
   DEBUG_PRINTLN("Interpretation took %lld ms", interp_time);
 #endif
 
+#if JIT
+  jit_free(&des);
+#endif
+
+  write_gc_stats();
   gc_stop(&gc);
 
   return 0;
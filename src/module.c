@@ -0,0 +1,102 @@
+#include <jit.h>
+#include <module.h>
+#include <registers.h>
+#include <switches.h>
+
+// Root scanner for a loaded module: marks the VM stack up to the stack
+// pointer, the constant pool and the program arguments precisely, and keeps
+// the loader's bookkeeping allocations alive.
+void module_mark_roots(GarbageCollector *gc, void *ctx) {
+  Module *module = ctx;
+
+  gc_mark_object(gc, module->stack);
+  gc_mark_values(gc, module->stack->values, module->stack->stack_pointer);
+
+  if (gc_mark_object(gc, module->constants))
+    gc_mark_values(gc, module->constants, module->constant_count);
+
+  if (gc_mark_object(gc, module->argv))
+    gc_mark_values(gc, module->argv, module->argc);
+
+  gc_mark_object(gc, module->instrs);
+  gc_mark_object(gc, module->threaded);
+  gc_mark_object(gc, module->tail_code);
+  gc_mark_object(gc, module->call_caches);
+  if (gc_mark_object(gc, module->registers)) {
+    gc_mark_object(gc, module->registers->code);
+    gc_mark_object(gc, module->registers->entries);
+  }
+  if (gc_mark_object(gc, module->switches)) {
+    for (int32_t i = 0; i < module->switch_count; i++) gc_mark_object(gc, module->switches[i]);
+  }
+#if JIT
+  if (gc_mark_object(gc, module->jit)) {
+    gc_mark_object(gc, module->jit->calls);
+    gc_mark_object(gc, module->jit->entries);
+  }
+#endif
+  gc_mark_object(gc, module->handles);
+  gc_mark_object(gc, module->natives);
+  gc_mark_object(gc, module->libraries.libraries);
+
+  for (int32_t i = 0; i < module->libraries.num_libraries; i++) {
+    gc_mark_object(gc, module->libraries.libraries[i].name);
+    if (module->natives != NULL) gc_mark_object(gc, module->natives[i].functions);
+  }
+}
+
+static Value scavenge_value(GarbageCollector *gc, Value value) {
+  if (!IS_PTR(value) || !gc_is_young(gc, GET_PTR(value))) return value;
+
+  HeapValue *v = GET_PTR(value);
+  HeapValue *moved = gc_young_forwarded(v);
+  if (moved == NULL) {
+    moved = gc_young_promote(gc, v);
+    gc_grey_push(gc, moved);
+  }
+  return MAKE_PTR(moved);
+}
+
+static void scavenge_values(GarbageCollector *gc, Value *values, uint32_t len) {
+  for (uint32_t i = 0; i < len; i++) values[i] = scavenge_value(gc, values[i]);
+}
+
+// Evacuates everything the elements of a list or mutable point to.
+static void scavenge_fields(GarbageCollector *gc, HeapValue *v) {
+  if (v->type != TYPE_LIST && v->type != TYPE_MUTABLE) return;
+  scavenge_values(gc, v->as_ptr, heap_fields(v));
+}
+
+// Minor collection: the module is the only mutator allowed to run while the
+// nursery is unpinned, so its stack, constants and arguments together with
+// the remembered set are all the roots into the young generation.
+void module_scavenge(GarbageCollector *gc, void *ctx) {
+  Module *module = ctx;
+
+  scavenge_values(gc, module->stack->values, module->stack->stack_pointer);
+  scavenge_values(gc, module->constants, module->constant_count);
+  scavenge_values(gc, module->argv, module->argc);
+
+  GcNursery *nursery = gc->nursery;
+  for (size_t i = 0; i < nursery->remembered_size; i++)
+    scavenge_fields(gc, nursery->remembered[i]);
+
+  HeapValue *v;
+  while ((v = gc_grey_pop(gc)) != NULL) scavenge_fields(gc, v);
+}
+
+static void mark_young(GarbageCollector *gc, void *obj, uint8_t kind, size_t size) {
+  (void) size;
+  if (kind != KIND_HEAPVALUE) return;
+
+  HeapValue *v = obj;
+  if (v->type == TYPE_LIST || v->type == TYPE_MUTABLE)
+    gc_mark_values(gc, v->as_ptr, heap_fields(v));
+}
+
+// Root scanner for major collections: young objects are not swept, but
+// whatever they reference in the old generation must survive.
+void nursery_mark_roots(GarbageCollector *gc, void *ctx) {
+  (void) ctx;
+  gc_nursery_walk(gc, mark_young);
+}
@@ -0,0 +1,40 @@
+#include <natives.h>
+#include <string.h>
+
+// MAKE_FLOAT takes an lvalue, and reads it through a pointer of another type
+static Value number(double x) {
+  Value v;
+  memcpy(&v, &x, sizeof(v));
+  return v;
+}
+
+static Value native_gc_stats(int argc, Deserialized *module, Value *args) {
+  (void) argc;
+  (void) args;
+
+  GcStats st;
+  gc_get_stats(&module->gc, &st);
+
+  // A single allocation of values without pointers, so that nothing it
+  // holds can be collected while it is built
+  Value stats[] = {
+    MAKE_INTEGER(st.collections), MAKE_INTEGER(st.minor_collections), MAKE_INTEGER(st.pauses),
+    number(st.pause_total_ns / 1e6), number(st.pause_max_ns / 1e6), number(st.bytes_allocated),
+    number(st.bytes_promoted), number(st.bytes_freed), number(st.heap_bytes),
+  };
+  return MAKE_LIST(module->gc, stats, sizeof(stats) / sizeof(*stats));
+}
+
+static const struct {
+  const char *name;
+  Native native;
+} builtins[] = {
+  { "gc_stats", native_gc_stats },
+};
+
+Native builtin_native(const char *name) {
+  for (size_t i = 0; i < sizeof(builtins) / sizeof(*builtins); i++) {
+    if (strcmp(builtins[i].name, name) == 0) return builtins[i].native;
+  }
+  return NULL;
+}
@@ -0,0 +1,429 @@
+#include <bytecode.h>
+#include <core/error.h>
+#include <interpreter.h>
+#include <registers.h>
+#include <verifier.h>
+
+// Register code names the slots of a frame by their offset from the base
+// pointer: locals are at negative offsets, and the operand stack slot at
+// depth d, which the stack interpreter would push to, is at 1 + d.
+//
+// Translation runs through each function body with the operand stack of
+// the bytecode, where loads of locals and constants are not executed but
+// carried to the instruction that uses them, and a result stored to a local
+// is computed directly into it. So
+//
+//   LoadLocal -2; LoadLocal -1; Add; StoreLocal -2
+//
+// is the single `Add -2, -2, -1`. Values still pending on the operand stack
+// are written to their slots before a branch and at the start of a basic
+// block, so that the stack is the one of the stack interpreter there. Blocks
+// are where register code is entered and left: an instruction that has no
+// register form ends its block with an exit to the interpreter, which
+// resumes at that instruction.
+
+typedef enum {
+  R_Move,          // a = b
+  R_LoadConstant,  // a = constants[b]
+  R_LoadGlobal,    // a = globals[b]
+  R_StoreGlobal,   // globals[a] = b
+  R_Add,           // a = b + c, then Sub and Mul
+  R_Sub,
+  R_Mul,
+  R_AddInt,        // Integer variants, which do not check b and c
+  R_SubInt,
+  R_MulInt,
+  R_AddConst,      // a = b + constants[c], then Sub and Mul
+  R_SubConst,
+  R_MulConst,
+  R_AddConstInt,
+  R_SubConstInt,
+  R_MulConstInt,
+  R_Compare,             // a = comparison_table[d](b, c)
+  R_Jump,                // to d
+  R_JumpElse,            // to d unless b
+  R_JumpElseCmp,         // to d unless comparison_table[a](b, c)
+  R_JumpElseICmp,        // to d unless icompare(a, b, c)
+  R_JumpElseEqConst,     // to d unless b equals constants[c]
+  R_JumpElseCmpConst,    // to d unless icompare(a, b, constants[c])
+  R_JumpElseCmpConstInt,
+  R_Exit,                // to the interpreter at program counter a, with b values on the operand stack
+} RegisterOpcode;
+
+// a, b and c are slots unless noted, d is the register instruction jumped to
+struct RegisterInstruction {
+  int32_t op, a, b, c, d;
+};
+
+static bool is_jump(int32_t op) { return op >= R_Jump && op <= R_JumpElseCmpConstInt; }
+
+// Where a value of the operand stack is during translation
+typedef enum { IN_SLOT, LOCAL, CONSTANT } Location;
+
+typedef struct {
+  Location location;
+  int32_t index;     // of the local or constant
+  int32_t producer;  // instruction that wrote the value to its slot, -1 if none
+} Operand;
+
+typedef struct {
+  Deserialized *module;
+  int32_t *depths;    // operand stack depth before each instruction, -1 if unreached
+  bool *natives;      // whether a native function is on top of the stack
+  int32_t *worklist;
+  int32_t *labels;    // register code of each instruction starting a block, -1 if none
+  bool *targets;      // whether an instruction is jumped to
+
+  RegisterInstruction *code;
+  int32_t count, capacity;
+
+  Operand *stack;
+  int32_t depth, max_depth;
+  bool live;  // whether control reaches the instruction being translated
+} Translator;
+
+static int32_t slot(int32_t depth) { return 1 + depth; }
+
+static int32_t emit(Translator *t, int32_t op, int32_t a, int32_t b, int32_t c, int32_t d) {
+  if (t->count == t->capacity) {
+    t->capacity = t->capacity * 2 + 64;
+    t->code = realloc(t->code, t->capacity * sizeof(RegisterInstruction));
+  }
+  t->code[t->count] = (RegisterInstruction) { op, a, b, c, d };
+  return t->count++;
+}
+
+// Depths of the operand stack in the function body starting at `first`, as
+// the verifier computed them
+static void measure(Translator *t, int32_t first) {
+  int32_t count = 0;
+  t->depths[first] = 0;
+  t->natives[first] = false;
+  t->worklist[count++] = first;
+
+  while (count > 0) {
+    int32_t i = t->worklist[--count];
+    Effect e = instruction_effect(t->module, i, t->natives[i]);
+    int32_t depth = t->depths[i] - e.pops + e.pushes;
+    if (depth > t->max_depth) t->max_depth = depth;
+
+    if (e.jumps) t->targets[e.target] = true;
+    for (int32_t k = 0; k < e.arm_count; k++) t->targets[i + e.arms[k]] = true;
+
+    // The arms of a Switch come after its next instruction and jump target
+    for (int32_t k = 0; k < 2 + e.arm_count; k++) {
+      int32_t next = k == 0 ? e.next : k == 1 ? (e.jumps ? e.target : -1) : i + e.arms[k - 2];
+      if (next < 0 || t->depths[next] >= 0) continue;
+      t->depths[next] = depth;
+      t->natives[next] = k == 0 && e.native;
+      t->worklist[count++] = next;
+    }
+  }
+}
+
+// Writes the j-th value of the operand stack to its slot
+static void materialize(Translator *t, int32_t j) {
+  Operand *o = &t->stack[j];
+  if (o->location == IN_SLOT) return;
+
+  int32_t op = o->location == LOCAL ? R_Move : R_LoadConstant;
+  *o = (Operand) { IN_SLOT, 0, emit(t, op, slot(j), o->index, 0, 0) };
+}
+
+static void flush(Translator *t) {
+  for (int32_t j = 0; j < t->depth; j++) materialize(t, j);
+}
+
+// Slot holding the j-th value of the operand stack
+static int32_t source(Translator *t, int32_t j) {
+  if (t->stack[j].location == CONSTANT) materialize(t, j);
+  return t->stack[j].location == LOCAL ? t->stack[j].index : slot(j);
+}
+
+static void push(Translator *t, Location location, int32_t index) {
+  t->stack[t->depth++] = (Operand) { location, index, -1 };
+}
+
+// Emits an instruction computing the next value of the operand stack
+static void produce(Translator *t, int32_t op, int32_t b, int32_t c, int32_t d) {
+  int32_t j = t->depth++;
+  t->stack[j] = (Operand) { IN_SLOT, 0, emit(t, op, slot(j), b, c, d) };
+}
+
+static void binary(Translator *t, int32_t op) {
+  int32_t top = source(t, t->depth - 1);
+  int32_t second = source(t, t->depth - 2);
+  t->depth -= 2;
+  produce(t, op, second, top, 0);
+}
+
+static void unary_const(Translator *t, int32_t op, int32_t constant) {
+  int32_t value = source(t, --t->depth);
+  produce(t, op, value, constant, 0);
+}
+
+static void store_local(Translator *t, int32_t l) {
+  int32_t j = --t->depth;
+  Operand o = t->stack[j];
+
+  // Values still to be read from the local are copied out before it changes
+  for (int32_t k = 0; k < j; k++) {
+    if (t->stack[k].location == LOCAL && t->stack[k].index == l) materialize(t, k);
+  }
+
+  if (o.location == LOCAL) {
+    if (o.index != l) emit(t, R_Move, l, o.index, 0, 0);
+  } else if (o.location == CONSTANT) {
+    emit(t, R_LoadConstant, l, o.index, 0, 0);
+  } else if (o.producer >= 0 && o.producer == t->count - 1) {
+    t->code[o.producer].a = l;
+  } else {
+    emit(t, R_Move, l, slot(j), 0, 0);
+  }
+}
+
+// Pops the condition of a branch and ends the block with it. The target is
+// an instruction index until `translate_registers` resolves it.
+static void branch(Translator *t, int32_t op, int32_t a, int32_t pops, int32_t c, int32_t target) {
+  int32_t b = source(t, t->depth - 1);
+  if (pops == 2) c = source(t, t->depth - 2);
+  t->depth -= pops;
+  flush(t);
+  emit(t, op, a, b, c, target);
+}
+
+static void exit_to_interpreter(Translator *t, int32_t i) {
+  flush(t);
+  emit(t, R_Exit, i * 4, t->depth, 0, 0);
+  t->live = false;
+}
+
+// IJumpElseRelCmp names its comparison by its index in comparison_table,
+// R_JumpElseICmp by the Comparison icompare takes. -1 if it has none.
+static int32_t icomparison(int32_t cmp) {
+  switch (cmp) {
+    case 2: return EqualTo;
+    case 5: return And;
+    case 6: return Or;
+  }
+  return -1;
+}
+
+static void translate(Translator *t, int32_t i) {
+  int32_t *in = &t->module->instrs[i * 4];
+  int32_t i1 = in[1], i2 = in[2], i3 = in[3];
+
+  switch (in[0]) {
+    case OP_LoadLocal: push(t, LOCAL, i1); break;
+    case OP_LoadConstant: push(t, CONSTANT, i1); break;
+    case OP_LoadGlobal: produce(t, R_LoadGlobal, i1, 0, 0); break;
+    case OP_StoreLocal: store_local(t, i1); break;
+    case OP_StoreGlobal: {
+      int32_t value = source(t, --t->depth);
+      emit(t, R_StoreGlobal, i1, value, 0, 0);
+      break;
+    }
+    case OP_Add: binary(t, R_Add); break;
+    case OP_Sub: binary(t, R_Sub); break;
+    case OP_Mul: binary(t, R_Mul); break;
+    case OP_AddInt: binary(t, R_AddInt); break;
+    case OP_SubInt: binary(t, R_SubInt); break;
+    case OP_MulInt: binary(t, R_MulInt); break;
+    case OP_AddConst: unary_const(t, R_AddConst, i1); break;
+    case OP_SubConst: unary_const(t, R_SubConst, i1); break;
+    case OP_MulConst: unary_const(t, R_MulConst, i1); break;
+    case OP_AddConstInt: unary_const(t, R_AddConstInt, i1); break;
+    case OP_SubConstInt: unary_const(t, R_SubConstInt, i1); break;
+    case OP_MulConstInt: unary_const(t, R_MulConstInt, i1); break;
+    case OP_Compare: {
+      int32_t top = source(t, t->depth - 1);
+      int32_t second = source(t, t->depth - 2);
+      t->depth -= 2;
+      produce(t, R_Compare, second, top, i1);
+      break;
+    }
+    case OP_JumpRel:
+      flush(t);
+      emit(t, R_Jump, 0, 0, 0, i + i1);
+      t->live = false;
+      break;
+    case OP_JumpElseRel: branch(t, R_JumpElse, 0, 1, 0, i + i1); break;
+    case OP_JumpElseRelCmp: branch(t, R_JumpElseCmp, i2, 2, 0, i + i1); break;
+    case OP_IJumpElseRelCmp:
+      if (icomparison(i1) < 0) exit_to_interpreter(t, i);
+      else branch(t, R_JumpElseICmp, icomparison(i1), 2, 0, i + i2);
+      break;
+    case OP_JumpElseRelCmpConst: branch(t, R_JumpElseEqConst, 0, 1, i3, i + i1); break;
+    case OP_IJumpElseRelCmpConst: branch(t, R_JumpElseCmpConst, i2, 1, i3, i + i1); break;
+    case OP_IJumpElseRelCmpConstInt: branch(t, R_JumpElseCmpConstInt, i2, 1, i3, i + i1); break;
+    default: exit_to_interpreter(t, i); break;
+  }
+}
+
+static int32_t body_length(int32_t *instr) {
+  if (instr[0] == OP_MakeLambda) return instr[1];
+  if (instr[0] == OP_MakeAndStoreLambda) return instr[2];
+  return 0;
+}
+
+static void translate_region(Translator *t, int32_t first, int32_t end, bool function) {
+  // Functions nested in this one are translated first
+  for (int32_t i = first; i < end; i++) {
+    int32_t *instr = &t->module->instrs[i * 4];
+    int32_t length = body_length(instr);
+    if (length > 0) translate_region(t, i + 1, i + 1 + length, true);
+    i += length;
+  }
+  // The top level has no frame to name slots in
+  if (!function || first == end) return;
+
+  measure(t, first);
+  t->stack = realloc(t->stack, (t->max_depth + 1) * sizeof(Operand));
+  t->live = false;
+
+  for (int32_t i = first; i < end; i++) {
+    int32_t *instr = &t->module->instrs[i * 4];
+
+    if (t->depths[i] < 0) {
+      t->live = false;
+    } else {
+      if (t->targets[i] || !t->live) {
+        if (t->live) flush(t);
+        t->depth = t->depths[i];
+        for (int32_t j = 0; j < t->depth; j++) t->stack[j] = (Operand) { IN_SLOT, 0, -1 };
+        t->labels[i] = t->count;
+        t->live = true;
+      }
+      translate(t, i);
+    }
+    i += body_length(instr);
+  }
+}
+
+void translate_registers(Deserialized *module) {
+  int32_t n = module->instr_count;
+  Translator t = {
+    .module = module,
+    .depths = malloc(n * sizeof(int32_t)),
+    .natives = malloc(n * sizeof(bool)),
+    .worklist = malloc(n * sizeof(int32_t)),
+    .labels = malloc(n * sizeof(int32_t)),
+    .targets = calloc(n, sizeof(bool)),
+  };
+  for (int32_t i = 0; i < n; i++) t.depths[i] = t.labels[i] = -1;
+
+  translate_region(&t, 0, n, false);
+
+  for (int32_t k = 0; k < t.count; k++) {
+    if (is_jump(t.code[k].op)) t.code[k].d = t.labels[t.code[k].d];
+  }
+
+  Registers *registers = gc_malloc(&module->gc, sizeof(Registers));
+  registers->code = gc_malloc(&module->gc, t.count * sizeof(RegisterInstruction));
+  registers->entries = gc_malloc(&module->gc, n * sizeof(int32_t));
+  memcpy(registers->code, t.code, t.count * sizeof(RegisterInstruction));
+
+  // Blocks that exit at once are not worth entering
+  for (int32_t i = 0; i < n; i++) {
+    int32_t entry = t.labels[i];
+    bool exits = entry >= 0 && t.code[entry].op == R_Exit && t.code[entry].a == i * 4;
+    registers->entries[i] = exits ? -1 : entry;
+  }
+  module->registers = registers;
+
+  free(t.depths);
+  free(t.natives);
+  free(t.worklist);
+  free(t.labels);
+  free(t.targets);
+  free(t.code);
+  free(t.stack);
+}
+
+RegisterExit registers_run(Deserialized *module, int32_t entry, int32_t bp) {
+  static void* const handlers[] = {
+    &&r_move, &&r_load_constant, &&r_load_global, &&r_store_global,
+    &&r_add, &&r_sub, &&r_mul, &&r_add_int, &&r_sub_int, &&r_mul_int,
+    &&r_add_const, &&r_sub_const, &&r_mul_const,
+    &&r_add_const_int, &&r_sub_const_int, &&r_mul_const_int,
+    &&r_compare, &&r_jump, &&r_jump_else, &&r_jump_else_cmp,
+    &&r_jump_else_icmp, &&r_jump_else_eq_const, &&r_jump_else_cmp_const,
+    &&r_jump_else_cmp_const_int, &&r_exit };
+
+  GarbageCollector gc = module->gc;
+  Value* values = module->stack->values;
+  Value* fp = values + bp;
+  Constants constants = module->constants;
+  const RegisterInstruction* code = module->registers->code;
+  const RegisterInstruction* ip = code + entry;
+
+  #define a ip->a
+  #define b ip->b
+  #define c ip->c
+
+  #define DISPATCH() goto *handlers[ip->op]
+  #define NEXT() do { ip++; DISPATCH(); } while (0)
+  #define JUMP_UNLESS(cond) do { ip = (cond) ? ip + 1 : code + ip->d; DISPATCH(); } while (0)
+
+  // The checks of the stack interpreter, on the same operands
+  #define CHECK_INTEGERS(top, second)                                                  \
+    ASSERT_FMT(get_type(top) == TYPE_INTEGER && get_type(second) == TYPE_INTEGER,      \
+               "Expected integers, got %s and %s", type_of(top), type_of(second))
+
+  DISPATCH();
+
+  r_move: fp[a] = fp[b]; NEXT();
+  r_load_constant: fp[a] = constants[b]; NEXT();
+  r_load_global: fp[a] = values[b]; NEXT();
+
+  r_store_global:
+    gc_value_barrier(&gc, values[a]);
+    values[a] = fp[b];
+    NEXT();
+
+  r_add: CHECK_INTEGERS(fp[c], fp[b]);
+  r_add_int: fp[a] = MAKE_INTEGER(fp[b] + fp[c]); NEXT();
+  r_sub: CHECK_INTEGERS(fp[c], fp[b]);
+  r_sub_int: fp[a] = MAKE_INTEGER(fp[b] - fp[c]); NEXT();
+  r_mul: CHECK_INTEGERS(fp[c], fp[b]);
+  r_mul_int: fp[a] = MAKE_INTEGER(fp[b] * fp[c]); NEXT();
+
+  r_add_const: CHECK_INTEGERS(fp[b], constants[c]);
+  r_add_const_int: fp[a] = MAKE_INTEGER(fp[b] + constants[c]); NEXT();
+  r_sub_const: CHECK_INTEGERS(fp[b], constants[c]);
+  r_sub_const_int: fp[a] = MAKE_INTEGER(fp[b] - constants[c]); NEXT();
+  r_mul_const: CHECK_INTEGERS(fp[b], constants[c]);
+  r_mul_const_int: fp[a] = MAKE_INTEGER(fp[b] * constants[c]); NEXT();
+
+  r_compare: fp[a] = comparison_table[ip->d](fp[b], fp[c]); NEXT();
+
+  r_jump: ip = code + ip->d; DISPATCH();
+
+  r_jump_else:
+    ASSERT(get_type(fp[b]) == TYPE_INTEGER, "Invalid value type");
+    JUMP_UNLESS(GET_INT(fp[b]) != 0);
+
+  r_jump_else_cmp: {
+    Value cmp = comparison_table[a](fp[b], fp[c]);
+    ASSERT(get_type(cmp) == TYPE_INTEGER, "Expected integer");
+    JUMP_UNLESS(GET_INT(cmp) != 0);
+  }
+
+  r_jump_else_icmp: JUMP_UNLESS(icompare(a, GET_INT(fp[b]), GET_INT(fp[c])) != 0);
+
+  r_jump_else_eq_const: {
+    ASSERT(get_type(fp[b]) == get_type(constants[c]), "Expected integers");
+    Value cmp = compare_eq(fp[b], constants[c]);
+    ASSERT(get_type(cmp) == TYPE_INTEGER, "Expected integer");
+    JUMP_UNLESS(GET_INT(cmp) != 0);
+  }
+
+  r_jump_else_cmp_const: ASSERT(get_type(fp[b]) == TYPE_INTEGER, "Expected integers");
+  r_jump_else_cmp_const_int: JUMP_UNLESS(icompare(a, GET_INT(fp[b]), GET_INT(constants[c])) != 0);
+
+  r_exit: return (RegisterExit) { a, fp + slot(b) };
+
+  #undef a
+  #undef b
+  #undef c
+}
@@ -0,0 +1,60 @@
+#include <bytecode.h>
+#include <superinstructions.h>
+
+// Superinstructions replace frequent opcode sequences by a single dispatch.
+// The sequences were chosen from opcode pair counts (see
+// PROFILE_OPCODE_PAIRS in interpreter.c): counted loops over globals,
+// and function bodies testing, decrementing and passing their arguments.
+// Integer variants (see inference.c) fuse into integer superinstructions.
+// A call followed by a return becomes a tail call, which replaces the frame
+// of the caller instead of pushing one, so tail recursion runs in constant
+// stack space.
+//
+// Only the opcode of the first instruction is rewritten. The instructions
+// that follow keep their opcode and operands, which the fused handler reads,
+// so the instruction count, jump offsets and return addresses are unchanged,
+// and a jump into the middle of a sequence still finds the original code.
+
+typedef struct {
+  Opcode sequence[3];
+  int32_t length;
+  Opcode fused;
+} Superinstruction;
+
+static const Superinstruction superinstructions[] = {
+  { { OP_LoadLocal, OP_LoadLocal, OP_Add }, 3, OP_LoadLocalLoadLocalAdd },
+  { { OP_LoadLocal, OP_LoadLocal, OP_AddInt }, 3, OP_LoadLocalLoadLocalAddInt },
+  { { OP_LoadGlobal, OP_AddConst, OP_StoreGlobal }, 3, OP_LoadGlobalAddConstStoreGlobal },
+  { { OP_LoadLocal, OP_SubConst }, 2, OP_LoadLocalSubConst },
+  { { OP_LoadLocal, OP_SubConstInt }, 2, OP_LoadLocalSubConstInt },
+  { { OP_LoadLocal, OP_Return }, 2, OP_LoadLocalReturn },
+  { { OP_LoadLocal, OP_IJumpElseRelCmpConst }, 2, OP_LoadLocalIJumpElseRelCmpConst },
+  { { OP_LoadLocal, OP_IJumpElseRelCmpConstInt }, 2, OP_LoadLocalIJumpElseRelCmpConstInt },
+  { { OP_LoadLocal, OP_CallGlobal }, 2, OP_LoadLocalCallGlobal },
+  { { OP_LoadGlobal, OP_ListGet }, 2, OP_LoadGlobalListGet },
+  { { OP_LoadGlobal, OP_IJumpElseRelCmpConst }, 2, OP_LoadGlobalIJumpElseRelCmpConst },
+  { { OP_StoreGlobal, OP_JumpRel }, 2, OP_StoreGlobalJumpRel },
+  { { OP_Call, OP_Return }, 2, OP_TailCall },
+  { { OP_CallGlobal, OP_Return }, 2, OP_TailCallGlobal },
+  { { OP_CallLocal, OP_Return }, 2, OP_TailCallLocal },
+};
+
+#define SUPERINSTRUCTION_COUNT (sizeof(superinstructions) / sizeof(Superinstruction))
+
+void fuse_superinstructions(int32_t *instrs, int32_t instr_count) {
+  for (int32_t i = 0; i < instr_count; i++) {
+    for (size_t s = 0; s < SUPERINSTRUCTION_COUNT; s++) {
+      const Superinstruction *super = &superinstructions[s];
+      if (i + super->length > instr_count) continue;
+
+      // Later instructions have not been rewritten yet
+      int32_t j = 0;
+      while (j < super->length && instrs[(i + j) * 4] == (int32_t) super->sequence[j]) j++;
+
+      if (j == super->length) {
+        instrs[i * 4] = super->fused;
+        break;
+      }
+    }
+  }
+}
@@ -0,0 +1,138 @@
+#include <bytecode.h>
+#include <core/error.h>
+#include <switches.h>
+
+typedef struct {
+  int32_t key, offset, name;
+} Arm;
+
+// By key, then by position in the table, so that the first arm of a key
+// sorts first
+static int compare_arms(const void *a, const void *b) {
+  const Arm *x = a, *y = b;
+  if (x->key != y->key) return x->key < y->key ? -1 : 1;
+  return x->name < y->name ? -1 : x->name > y->name;
+}
+
+static Switch *build(Deserialized *module, int32_t i) {
+  int32_t *in = &module->instrs[i * 4];
+  Constants constants = module->constants;
+  int32_t first = in[1];
+
+  if (first < 0 || first >= module->constant_count || get_type(constants[first]) != TYPE_INTEGER)
+    THROW_FMT("Invalid switch table %d at IPC %d", first, i * 4);
+  int32_t n = (int32_t) GET_INT(constants[first]);
+  if (n < 1 || n > (module->constant_count - first - 1) / 2)
+    THROW_FMT("Invalid arm count %d at IPC %d", n, i * 4);
+
+  ValueType type = get_type(constants[first + 1]);
+  if (type != TYPE_INTEGER && type != TYPE_STRING)
+    THROW_FMT("Cannot switch on %s keys at IPC %d", type_of(constants[first + 1]), i * 4);
+
+  Arm *arms = malloc(n * sizeof(Arm));
+  for (int32_t k = 0; k < n; k++) {
+    int32_t name = first + 1 + 2 * k;
+    Value key = constants[name], offset = constants[name + 1];
+    if (get_type(key) != type) THROW_FMT("Mixed switch keys at IPC %d", i * 4);
+    if (get_type(offset) != TYPE_INTEGER) THROW_FMT("Invalid arm offset at IPC %d", i * 4);
+    if (type == TYPE_STRING && GET_PTR(key)->tag == 0) THROW_FMT("Untagged switch key at IPC %d", i * 4);
+
+    int32_t value = type == TYPE_STRING ? (int32_t) GET_PTR(key)->tag : (int32_t) GET_INT(key);
+    arms[k] = (Arm) { value, (int32_t) GET_INT(offset), name };
+  }
+  qsort(arms, n, sizeof(Arm), compare_arms);
+
+  int32_t count = 0;
+  for (int32_t k = 0; k < n; k++) {
+    if (count == 0 || arms[count - 1].key != arms[k].key) arms[count++] = arms[k];
+  }
+
+  // Dense when the keys cover at least half of their range
+  int64_t span = (int64_t) arms[count - 1].key - arms[0].key + 1;
+  if (span > 2 * (int64_t) count) span = 0;
+
+  Switch *s = gc_malloc(&module->gc, sizeof(Switch) + (3 * count + span) * sizeof(int32_t));
+  int32_t *data = (int32_t *) (s + 1);
+  *s = (Switch) {
+    .type = type,
+    .otherwise = in[2],
+    .count = count,
+    .keys = data,
+    .offsets = data + count,
+    .names = data + 2 * count,
+    .min = arms[0].key,
+    .span = (int32_t) span,
+    .dense = span > 0 ? data + 3 * count : NULL,
+  };
+
+  for (int32_t k = 0; k < span; k++) s->dense[k] = s->otherwise;
+  for (int32_t k = 0; k < count; k++) {
+    s->keys[k] = arms[k].key;
+    s->offsets[k] = arms[k].offset;
+    s->names[k] = arms[k].name;
+    if (span > 0) s->dense[arms[k].key - s->min] = arms[k].offset;
+  }
+
+  free(arms);
+  return s;
+}
+
+void build_switches(Deserialized *module) {
+  int32_t count = 0;
+  for (int32_t i = 0; i < module->instr_count; i++) {
+    if (module->instrs[i * 4] == OP_Switch) count++;
+  }
+  if (count == 0) return;
+
+  module->switches = gc_malloc(&module->gc, count * sizeof(Switch *));
+  for (int32_t i = 0; i < module->instr_count; i++) {
+    int32_t *in = &module->instrs[i * 4];
+    if (in[0] != OP_Switch) continue;
+
+    in[3] = module->switch_count;
+    module->switches[module->switch_count++] = build(module, i);
+  }
+}
+
+// Arm of a name built at run time, `s->count` if none
+static int32_t untagged_arm(Deserialized *module, Switch *s, Value name) {
+  // Keys with the same tag are spelled the same, so at most one matches
+  for (int32_t k = 0; k < s->count; k++) {
+    if (string_equal(GET_PTR(module->constants[s->names[k]]), GET_PTR(name))) return k;
+  }
+  return s->count;
+}
+
+int32_t switch_untagged(Deserialized *module, Switch *s, Value name) {
+  int32_t k = untagged_arm(module, s, name);
+  return k < s->count ? s->offsets[k] : s->otherwise;
+}
+
+int32_t switch_slot(Deserialized *module, Switch *s, Value value) {
+  int32_t otherwise = switch_slots(s) - 1;
+  int32_t key;
+  if (s->type == TYPE_STRING) {
+    key = (int32_t) GET_PTR(value)->tag;
+    if (key == 0) {
+      int32_t k = untagged_arm(module, s, value);
+      if (k == s->count) return otherwise;
+      if (s->dense == NULL) return k;
+      key = s->keys[k];
+    }
+  } else {
+    key = (int32_t) GET_INT(value);
+  }
+
+  if (s->dense != NULL) {
+    uint32_t k = (uint32_t) key - (uint32_t) s->min;
+    return k < (uint32_t) s->span ? (int32_t) k : otherwise;
+  }
+
+  int32_t low = 0, high = s->count;
+  while (low < high) {
+    int32_t mid = low + (high - low) / 2;
+    if (s->keys[mid] < key) low = mid + 1;
+    else high = mid;
+  }
+  return low < s->count && s->keys[low] == key ? low : otherwise;
+}
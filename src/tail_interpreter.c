@@ -0,0 +1,968 @@
+#include <bytecode.h>
+#include <callstack.h>
+#include <core/debug.h>
+#include <core/error.h>
+#include <interpreter.h>
+#include <jit.h>
+#include <module.h>
+#include <registers.h>
+#include <stack.h>
+#include <stdio.h>
+#include <switches.h>
+#include <value.h>
+
+// A tail-calling interpreter: every opcode is a function that ends by
+// calling the handler of the next instruction in tail position. The
+// interpreter registers are function arguments, so they stay in machine
+// registers across dispatches, and each handler is register-allocated on its
+// own rather than as part of one giant function.
+//
+// Dispatch must compile to a jump, or the C stack grows with every executed
+// instruction. Clang (and GCC 15) guarantee it with `musttail`. Older GCC
+// only performs the sibling call optimization when optimizing, so debug
+// builds of this interpreter are limited to short programs.
+
+#if defined(__has_attribute)
+#if __has_attribute(musttail)
+#define MUSTTAIL __attribute__((musttail))
+#endif
+#endif
+
+#ifndef MUSTTAIL
+#define MUSTTAIL
+#endif
+
+typedef struct TailState TailState;
+typedef struct TailInstruction TailInstruction;
+
+typedef Value (*Handler)(TailState *st, const TailInstruction *ip, Value *sp, int32_t bp);
+
+struct TailInstruction {
+  Handler handler;
+  int32_t operands[3];
+};
+
+// What stays the same for a whole run, shared by all handlers
+struct TailState {
+  Deserialized *module;
+  const TailInstruction *code;
+  Value *values;
+  Constants constants;
+  GarbageCollector gc;
+  bool does_return;
+  int32_t current_callstack;
+};
+
+#define HANDLER(name) \
+  static Value name(TailState *st, const TailInstruction *ip, Value *sp, int32_t bp)
+
+#define DISPATCH() MUSTTAIL return ip->handler(st, ip, sp, bp)
+#define TAIL(handler) MUSTTAIL return handler(st, ip, sp, bp)
+
+#define INCREASE_IP_BY(x) (ip += (x))
+#define INCREASE_IP() INCREASE_IP_BY(1)
+
+#define i1 ip->operands[0]
+#define i2 ip->operands[1]
+#define i3 ip->operands[2]
+
+// Operand k of the n-th instruction after the current one
+#define in(n, k) ip[n].operands[(k) - 1]
+
+#define values st->values
+#define constants st->constants
+#define module st->module
+
+#define PC() ((int32_t) (ip - st->code) * 4)
+
+// Same sync points as the computed-goto loop in interpreter.c
+#define SAVE_SP() (module->stack->stack_pointer = (int16_t) (sp - values))
+#define SAVE_STATE() (module->pc = PC(), SAVE_SP(), module->base_pointer = bp)
+#define LOAD_STATE()                                                    \
+  (ip = st->code + module->pc / 4, sp = values + module->stack->stack_pointer, \
+   bp = module->base_pointer)
+
+#define PUSH(value) (*sp++ = (value))
+#define POP() (*--sp)
+
+// As in interpreter.c
+#if JIT
+#define JIT_ENTER()                                                        \
+  do {                                                                     \
+    JitExit exit_ = jit_run(module->jit, PC(), values, sp, bp, constants); \
+    ip = st->code + exit_.pc / 4;                                          \
+    sp = exit_.sp;                                                         \
+  } while (0)
+#define JIT_COUNT_CALL(ipc) jit_count_call(module, (ipc))
+#else
+#define JIT_ENTER()
+#define JIT_COUNT_CALL(ipc)
+#endif
+
+#if REGISTER_TIER
+#define REGISTERS_ENTER()                                                  \
+  do {                                                                     \
+    RegisterExit exit_ = registers_enter(module, PC(), sp, bp);            \
+    ip = st->code + exit_.pc / 4;                                          \
+    sp = exit_.sp;                                                         \
+  } while (0)
+#else
+#define REGISTERS_ENTER()
+#endif
+
+HANDLER(op_unknown) {
+  (void) sp, (void) bp;
+  THROW_FMT("Unknown opcode: %d", module->instrs[PC()]);
+  return 0;
+}
+
+HANDLER(op_load_local) {
+  PUSH(values[bp + i1]);
+  INCREASE_IP();
+  DISPATCH();
+}
+
+HANDLER(op_store_local) {
+  values[bp + i1] = POP();
+  INCREASE_IP();
+  DISPATCH();
+}
+
+HANDLER(op_load_constant) {
+  PUSH(constants[i1]);
+  INCREASE_IP();
+  DISPATCH();
+}
+
+HANDLER(op_load_global) {
+  PUSH(values[i1]);
+  INCREASE_IP();
+  DISPATCH();
+}
+
+HANDLER(op_store_global) {
+  gc_value_barrier(&st->gc, values[i1]);
+  values[i1] = POP();
+  INCREASE_IP();
+  DISPATCH();
+}
+
+HANDLER(op_return) {
+  Frame fr = read_frame(values[bp]);
+  module->callstack--;
+  Value ret = POP();
+
+  sp = values + fr.stack_pointer;
+  bp = fr.base_ptr;
+  PUSH(ret);
+
+  ip = st->code + fr.instruction_pointer / 4;
+
+  if (st->does_return && st->current_callstack == module->callstack) {
+    SAVE_STATE();
+    return ret;
+  }
+
+  JIT_ENTER();
+  REGISTERS_ENTER();
+  DISPATCH();
+}
+
+// As in interpreter.c, the checks the verifier makes at load are split off
+// into a handler of their own, which verified modules skip, and so are the
+// checks of operand types, which integer variants skip.
+
+HANDLER(op_compare_verified) {
+  Value a = POP();
+  Value b = POP();
+
+  PUSH(comparison_table[i1](b, a));
+  INCREASE_IP();
+  DISPATCH();
+}
+
+HANDLER(op_compare) {
+  ASSERT_FMT(valid_comparison(i1), "Invalid comparison %d", i1);
+  TAIL(op_compare_verified);
+}
+
+HANDLER(op_and) {
+  Value a = POP();
+  Value b = POP();
+
+  ASSERT_FMT(get_type(a) == TYPE_INTEGER && get_type(b) == TYPE_INTEGER, "Expected integers, got %s and %s", type_of(a), type_of(b));
+
+  PUSH(MAKE_INTEGER(a && b));
+  INCREASE_IP();
+  DISPATCH();
+}
+
+HANDLER(op_or) {
+  Value a = POP();
+  Value b = POP();
+
+  ASSERT_FMT(get_type(a) == TYPE_INTEGER && get_type(b) == TYPE_INTEGER, "Expected integers, got %s and %s", type_of(a), type_of(b));
+
+  PUSH(MAKE_INTEGER(a || b));
+  INCREASE_IP();
+  DISPATCH();
+}
+
+HANDLER(op_load_native_verified) {
+  Value name = constants[i1];
+  PUSH(MAKE_INTEGER(i2));
+  PUSH(MAKE_INTEGER(i3));
+  PUSH(name);
+  INCREASE_IP();
+  DISPATCH();
+}
+
+HANDLER(op_load_native) {
+  ASSERT(get_type(constants[i1]) == TYPE_STRING, "Invalid native function name type");
+  TAIL(op_load_native_verified);
+}
+
+HANDLER(op_make_list) {
+  // Elements stay on the stack until the allocation succeeded
+  SAVE_SP();
+  Value list = MAKE_PACKED_LIST(st->gc, sp - i1, i1);
+  sp -= i1;
+  PUSH(list);
+  INCREASE_IP();
+  DISPATCH();
+}
+
+HANDLER(op_list_get) {
+  Value list = POP();
+  uint32_t idx = GET_INT(i1);
+  ASSERT_FMT(get_type(list) == TYPE_LIST, "Invalid list type at IPC %d", PC() / 4);
+  HeapValue* l = GET_PTR(list);
+  ASSERT(idx < l->length, "Index out of bounds");
+  PUSH(list_element(l, idx));
+  INCREASE_IP();
+  DISPATCH();
+}
+
+HANDLER(op_call_quickened);
+HANDLER(op_call_global_quickened);
+HANDLER(op_call_local_quickened);
+HANDLER(op_call_native_quickened);
+
+// Handlers of quickened calls of bytecode functions
+static const Handler quickened_handlers[OPCODE_COUNT] = {
+  [OP_Call] = op_call_quickened,
+  [OP_CallGlobal] = op_call_global_quickened,
+  [OP_CallLocal] = op_call_local_quickened };
+
+// Calls are quickened as in interpreter.c
+#define QUICKEN(quickened, callee_, native_)                                            \
+  do {                                                                                  \
+    Handler handler_ = (quickened);                                                     \
+    if (!module->verified || handler_ == NULL) break;                                   \
+    module->call_caches[PC() / 4].native = (native_);                                   \
+    module->call_caches[PC() / 4].callee = (callee_);                                   \
+    __atomic_store_n(&module->tail_code[PC() / 4].handler, handler_, __ATOMIC_RELEASE); \
+  } while (0)
+
+// Calls the bytecode function `callee` with `argc` arguments on the stack.
+// Handlers cannot take extra arguments and still be tail-called, hence
+// macros.
+#define CALL_FUNCTION(callee, argc)                                                                   \
+  do {                                                                                                \
+    Value function_ = (callee);                                                                       \
+    int32_t arity_ = (argc);                                                                          \
+    ASSERT_FMT(module->callstack < MAX_FRAMES, "Call stack overflow, reached %d", module->callstack); \
+                                                                                                      \
+    int16_t ipc = (int16_t) (function_ & MASK_PAYLOAD_INT);                                           \
+    int16_t local_space = (int16_t) ((function_ >> 16) & MASK_PAYLOAD_INT);                           \
+    int16_t old_sp = (int16_t) (sp - values) - arity_;                                                \
+                                                                                                      \
+    clear_locals(sp, local_space - arity_);                                                           \
+    sp += local_space - arity_;                                                                       \
+    PUSH(MAKE_FUNCENV(PC() + 4, old_sp, bp));                                                         \
+                                                                                                      \
+    bp = (int32_t) (sp - values) - 1;                                                                 \
+    module->callstack++;                                                                              \
+                                                                                                      \
+    ip = st->code + ipc / 4;                                                                          \
+    JIT_COUNT_CALL(ipc);                                                                              \
+    JIT_ENTER();                                                                                      \
+    REGISTERS_ENTER();                                                                                \
+    DISPATCH();                                                                                       \
+  } while (0)
+
+// Calls the function or native `callee`, and quickens the call
+#define CALL(callee, argc)                                                                      \
+  do {                                                                                          \
+    Value callee_ = (callee);                                                                   \
+    int32_t argc_ = (argc);                                                                     \
+    ASSERT(IS_FUN(callee_) || IS_PTR(callee_), "Invalid callee type");                          \
+                                                                                                \
+    if ((callee_ & MASK_SIGNATURE) != SIGNATURE_FUNCTION) {                                     \
+      SAVE_STATE();                                                                             \
+      Native native_ = resolve_native(module, callee_);                                         \
+      if (module->instrs[PC()] == OP_Call) QUICKEN(op_call_native_quickened, callee_, native_); \
+      invoke_native(module, native_, argc_);                                                    \
+      LOAD_STATE();                                                                             \
+      INCREASE_IP();                                                                            \
+      DISPATCH();                                                                               \
+    }                                                                                           \
+                                                                                                \
+    QUICKEN(quickened_handlers[module->instrs[PC()]], callee_, NULL);                           \
+    CALL_FUNCTION(callee_, argc_);                                                              \
+  } while (0)
+
+HANDLER(op_call) {
+  Value callee = POP();
+  CALL(callee, i1);
+}
+
+HANDLER(op_call_global) {
+  CALL(values[i1], i2);
+}
+
+HANDLER(op_call_local) {
+  CALL(values[bp + i1], i2);
+}
+
+// Quickened calls. Another callee than the cached one takes the generic
+// path, which caches it instead.
+
+HANDLER(op_call_quickened) {
+  Value callee = POP();
+  if (callee != module->call_caches[PC() / 4].callee) CALL(callee, i1);
+  CALL_FUNCTION(callee, i1);
+}
+
+HANDLER(op_call_global_quickened) {
+  Value callee = values[i1];
+  if (callee != module->call_caches[PC() / 4].callee) CALL(callee, i2);
+  CALL_FUNCTION(callee, i2);
+}
+
+HANDLER(op_call_local_quickened) {
+  Value callee = values[bp + i1];
+  if (callee != module->call_caches[PC() / 4].callee) CALL(callee, i2);
+  CALL_FUNCTION(callee, i2);
+}
+
+HANDLER(op_call_native_quickened) {
+  Value callee = POP();
+  CallCache* cache = &module->call_caches[PC() / 4];
+  if (callee != cache->callee) CALL(callee, i1);
+
+  // The library and function indices
+  sp -= 2;
+  SAVE_STATE();
+  invoke_native(module, cache->native, i1);
+  LOAD_STATE();
+  INCREASE_IP();
+  DISPATCH();
+}
+
+// Tail calls, as in interpreter.c
+#define TAIL_CALL(callee, argc)                                                      \
+  do {                                                                               \
+    Value function_ = (callee);                                                      \
+    int32_t arity_ = (argc);                                                         \
+    if ((function_ & MASK_SIGNATURE) != SIGNATURE_FUNCTION) CALL(function_, arity_); \
+                                                                                     \
+    Value env = values[bp];                                                          \
+    int16_t old_sp = (int16_t) read_frame(env).stack_pointer;                        \
+    int16_t ipc = (int16_t) (function_ & MASK_PAYLOAD_INT);                          \
+    int16_t local_space = (int16_t) ((function_ >> 16) & MASK_PAYLOAD_INT);          \
+                                                                                     \
+    memmove(values + old_sp, sp - arity_, arity_ * sizeof(Value));                   \
+    clear_locals(values + old_sp + arity_, local_space - arity_);                    \
+    sp = values + old_sp + local_space;                                              \
+    PUSH(env);                                                                       \
+    bp = (int32_t) (sp - values) - 1;                                                \
+                                                                                     \
+    ip = st->code + ipc / 4;                                                         \
+    JIT_COUNT_CALL(ipc);                                                             \
+    JIT_ENTER();                                                                     \
+    REGISTERS_ENTER();                                                               \
+    DISPATCH();                                                                      \
+  } while (0)
+
+HANDLER(op_tail_call) {
+  Value callee = POP();
+  TAIL_CALL(callee, i1);
+}
+
+HANDLER(op_tail_call_global) {
+  TAIL_CALL(values[i1], i2);
+}
+
+HANDLER(op_tail_call_local) {
+  TAIL_CALL(values[bp + i1], i2);
+}
+
+HANDLER(op_jump_else_rel) {
+  Value value = POP();
+  ASSERT(get_type(value) == TYPE_INTEGER, "Invalid value type")
+  if (GET_INT(value) == 0) {
+    INCREASE_IP_BY(i1);
+  } else {
+    INCREASE_IP();
+  }
+  DISPATCH();
+}
+
+HANDLER(op_type_of) {
+  Value value = POP();
+  SAVE_SP();
+  PUSH(MAKE_STRING(module->gc, type_of(value)));
+  INCREASE_IP();
+  DISPATCH();
+}
+
+HANDLER(op_make_lambda) {
+  int32_t new_pc = PC() + 4;
+  Value lambda = MAKE_FUNCTION(new_pc, i2);
+
+  PUSH(lambda);
+  INCREASE_IP_BY(i1 + 1);
+
+  DISPATCH();
+}
+
+HANDLER(op_get_index) {
+  Value index = POP();
+  Value list = POP();
+  ASSERT(get_type(list) == TYPE_LIST, "Invalid list type");
+  ASSERT(get_type(index) == TYPE_INTEGER, "Invalid index type");
+
+  HeapValue* l = GET_PTR(list);
+  uint32_t idx = GET_INT(index);
+
+  ASSERT(idx < l->length, "Index out of bounds");
+  PUSH(list_element(l, idx));
+  INCREASE_IP();
+  DISPATCH();
+}
+
+HANDLER(op_special) {
+  PUSH(MAKE_SPECIAL());
+  INCREASE_IP();
+  DISPATCH();
+}
+
+HANDLER(op_jump_rel) {
+  INCREASE_IP_BY(i1);
+  DISPATCH();
+}
+
+HANDLER(op_slice) {
+  ASSERT(get_type(sp[-1]) == TYPE_LIST, "Invalid list type");
+  ASSERT(i1 >= 0 && (uint32_t) i1 <= GET_PTR(sp[-1])->length, "Slice out of bounds");
+
+  // The source list stays on the stack while the view is allocated
+  SAVE_SP();
+  sp[-1] = MAKE_SLICE(st->gc, &sp[-1], i1);
+  INCREASE_IP();
+  DISPATCH();
+}
+
+HANDLER(op_list_length) {
+  Value list = POP();
+  ASSERT_FMT(get_type(list) == TYPE_LIST, "Invalid list type at IPC %d", PC() / 4);
+  HeapValue* l = GET_PTR(list);
+  PUSH(MAKE_INTEGER(l->length));
+  INCREASE_IP();
+  DISPATCH();
+}
+
+HANDLER(op_halt) {
+  halt = 1;
+  SAVE_STATE();
+  return 0;
+}
+
+HANDLER(op_update) {
+  Value var = POP();
+  ASSERT(get_type(var) == TYPE_MUTABLE, "Invalid mutable type");
+
+  HeapValue* l = GET_PTR(var);
+
+  Value value = POP();
+  gc_value_barrier(&st->gc, l->as_ptr[0]);
+  l->as_ptr[0] = value;
+  gc_write_barrier(&st->gc, l, value);
+  INCREASE_IP();
+  DISPATCH();
+}
+
+HANDLER(op_make_mutable) {
+  SAVE_SP();
+  HeapValue* l = ALLOC_HEAP_VALUE(st->gc, TYPE_MUTABLE, 1, sizeof(Value));
+  Value value = POP();
+  l->as_ptr[0] = value;
+  gc_write_barrier(&st->gc, l, value);
+  PUSH(MAKE_PTR(l));
+  INCREASE_IP();
+  DISPATCH();
+}
+
+HANDLER(op_unmut) {
+  Value value = POP();
+  ASSERT(get_type(value) == TYPE_MUTABLE, "Invalid mutable type");
+  PUSH(GET_MUTABLE(value));
+  INCREASE_IP();
+  DISPATCH();
+}
+
+HANDLER(op_add_int) {
+  Value a = POP();
+  Value b = POP();
+
+  PUSH(MAKE_INTEGER(a + b));
+  INCREASE_IP();
+  DISPATCH();
+}
+
+HANDLER(op_add) {
+  ASSERT_FMT(get_type(sp[-1]) == TYPE_INTEGER && get_type(sp[-2]) == TYPE_INTEGER, "Expected integers, got %s and %s", type_of(sp[-1]), type_of(sp[-2]));
+  TAIL(op_add_int);
+}
+
+HANDLER(op_sub_int) {
+  Value a = POP();
+  Value b = POP();
+
+  PUSH(MAKE_INTEGER(b - a));
+  INCREASE_IP();
+  DISPATCH();
+}
+
+HANDLER(op_sub) {
+  ASSERT_FMT(get_type(sp[-1]) == TYPE_INTEGER && get_type(sp[-2]) == TYPE_INTEGER, "Expected integers, got %s and %s", type_of(sp[-1]), type_of(sp[-2]));
+  TAIL(op_sub_int);
+}
+
+HANDLER(op_return_const) {
+  Frame fr = read_frame(values[bp]);
+  module->callstack--;
+  sp = values + fr.stack_pointer;
+  bp = fr.base_ptr;
+
+  Value ret = constants[i1];
+  PUSH(ret);
+
+  ip = st->code + fr.instruction_pointer / 4;
+
+  if (st->does_return) {
+    SAVE_STATE();
+    return ret;
+  }
+
+  JIT_ENTER();
+  REGISTERS_ENTER();
+  DISPATCH();
+}
+
+HANDLER(op_add_const_int) {
+  Value a = POP();
+  Value b = constants[i1];
+
+  PUSH(MAKE_INTEGER(a + b));
+  INCREASE_IP();
+  DISPATCH();
+}
+
+HANDLER(op_add_const_verified) {
+  ASSERT_FMT(get_type(sp[-1]) == TYPE_INTEGER, "Expected integers, got %s and %s", type_of(sp[-1]), type_of(constants[i1]));
+  TAIL(op_add_const_int);
+}
+
+HANDLER(op_add_const) {
+  ASSERT_FMT(get_type(constants[i1]) == TYPE_INTEGER, "Expected integer constant, got %s", type_of(constants[i1]));
+  TAIL(op_add_const_verified);
+}
+
+HANDLER(op_sub_const_int) {
+  Value a = POP();
+  Value b = constants[i1];
+
+  PUSH(MAKE_INTEGER(a - b));
+  INCREASE_IP();
+  DISPATCH();
+}
+
+HANDLER(op_sub_const_verified) {
+  ASSERT_FMT(get_type(sp[-1]) == TYPE_INTEGER, "Expected integers, got %s and %s", type_of(sp[-1]), type_of(constants[i1]));
+  TAIL(op_sub_const_int);
+}
+
+HANDLER(op_sub_const) {
+  ASSERT_FMT(get_type(constants[i1]) == TYPE_INTEGER, "Expected integer constant, got %s", type_of(constants[i1]));
+  TAIL(op_sub_const_verified);
+}
+
+HANDLER(op_jump_else_rel_cmp_verified) {
+  Value a = POP();
+  Value b = POP();
+
+  Value cmp = comparison_table[i2](a, b);
+  ASSERT(get_type(cmp) == TYPE_INTEGER, "Expected integer");
+
+  if (GET_INT(cmp) == 0) {
+    INCREASE_IP_BY(i1);
+  } else {
+    INCREASE_IP();
+  }
+
+  DISPATCH();
+}
+
+HANDLER(op_jump_else_rel_cmp) {
+  ASSERT_FMT(valid_comparison(i2), "Invalid comparison %d", i2);
+  TAIL(op_jump_else_rel_cmp_verified);
+}
+
+HANDLER(op_ijump_else_rel_cmp_verified) {
+  Value a = POP();
+  Value b = POP();
+
+  // Indexed like comparison_table, only equality, and and or are defined
+  int32_t res;
+  switch (i1) {
+    case 2: res = GET_INT(a) == GET_INT(b); break;
+    case 5: res = GET_INT(a) & GET_INT(b); break;
+    case 6: res = GET_INT(a) | GET_INT(b); break;
+    default: TAIL(op_unknown);
+  }
+
+  INCREASE_IP_BY(res == 0 ? i2 : 1);
+  DISPATCH();
+}
+
+HANDLER(op_ijump_else_rel_cmp) {
+  ASSERT_FMT(i1 == 2 || i1 == 5 || i1 == 6, "Invalid integer comparison %d", i1);
+  TAIL(op_ijump_else_rel_cmp_verified);
+}
+
+HANDLER(op_jump_else_rel_cmp_constant) {
+  Value a = POP();
+  Value b = constants[i3];
+
+  ASSERT(get_type(a) == get_type(b), "Expected integers");
+
+  Value cmp = compare_eq(a, b);
+  ASSERT(get_type(cmp) == TYPE_INTEGER, "Expected integer");
+
+  if (GET_INT(cmp) == 0) {
+    INCREASE_IP_BY(i1);
+  } else {
+    INCREASE_IP();
+  }
+
+  DISPATCH();
+}
+
+HANDLER(op_switch) {
+  Value value = POP();
+  Switch *s = module->switches[i3];
+  ASSERT_FMT(get_type(value) == s->type, "Cannot switch on %s", type_of(value));
+
+  INCREASE_IP_BY(switch_offset(module, s, value));
+  DISPATCH();
+}
+
+HANDLER(op_ijump_else_rel_cmp_constant_int) {
+  Value a = POP();
+  Value b = constants[i3];
+
+  uint32_t res = icompare(i2, GET_INT(a), GET_INT(b));
+  INCREASE_IP_BY(res == 0 ? i1 : 1);
+  DISPATCH();
+}
+
+HANDLER(op_ijump_else_rel_cmp_constant_verified) {
+  ASSERT(get_type(sp[-1]) == TYPE_INTEGER, "Expected integers");
+  TAIL(op_ijump_else_rel_cmp_constant_int);
+}
+
+HANDLER(op_ijump_else_rel_cmp_constant) {
+  ASSERT_FMT(i2 >= LessThan && i2 <= Or, "Invalid integer comparison %d", i2);
+  ASSERT_FMT(get_type(constants[i3]) == TYPE_INTEGER, "Expected integer constant, got %s", type_of(constants[i3]));
+  TAIL(op_ijump_else_rel_cmp_constant_verified);
+}
+
+HANDLER(op_make_and_store_lambda) {
+  int32_t new_pc = PC() + 4;
+  Value lambda = MAKE_FUNCTION(new_pc, i3);
+
+  values[i1] = lambda;
+
+  INCREASE_IP_BY(i2 + 1);
+  DISPATCH();
+}
+
+HANDLER(op_mul_int) {
+  Value a = POP();
+  Value b = POP();
+
+  PUSH(MAKE_INTEGER(a * b));
+  INCREASE_IP();
+  DISPATCH();
+}
+
+HANDLER(op_mul) {
+  ASSERT_FMT(get_type(sp[-1]) == TYPE_INTEGER && get_type(sp[-2]) == TYPE_INTEGER, "Expected integers, got %s and %s", type_of(sp[-1]), type_of(sp[-2]));
+  TAIL(op_mul_int);
+}
+
+HANDLER(op_mul_const_int) {
+  Value a = POP();
+  Value b = constants[i1];
+
+  PUSH(MAKE_INTEGER(a * b));
+  INCREASE_IP();
+  DISPATCH();
+}
+
+HANDLER(op_mul_const_verified) {
+  ASSERT_FMT(get_type(sp[-1]) == TYPE_INTEGER, "Expected integers, got %s and %s", type_of(sp[-1]), type_of(constants[i1]));
+  TAIL(op_mul_const_int);
+}
+
+HANDLER(op_mul_const) {
+  ASSERT_FMT(get_type(constants[i1]) == TYPE_INTEGER, "Expected integer constant, got %s", type_of(constants[i1]));
+  TAIL(op_mul_const_verified);
+}
+
+HANDLER(op_return_unit) {
+  Frame fr = read_frame(values[bp]);
+  module->callstack--;
+  sp = values + fr.stack_pointer;
+  bp = fr.base_ptr;
+
+  SAVE_SP();
+  GarbageCollector* gc = &st->gc;
+  gc_nursery_reserve(gc, gc_young_footprint(gc, HEAP_VALUE_SIZE(sizeof(Value) * 3)) +
+                         2 * gc_young_footprint(gc, HEAP_VALUE_SIZE(sizeof("unit"))));
+  HeapValue* l = ALLOC_HEAP_VALUE(st->gc, TYPE_LIST, 3, sizeof(Value) * 3);
+  l->as_ptr[0] = MAKE_SPECIAL();
+  l->as_ptr[1] = MAKE_STRING(module->gc, "unit");
+  l->as_ptr[2] = MAKE_STRING(module->gc, "unit");
+  gc_list_barrier(gc, l);
+
+  Value unit = MAKE_PTR(l);
+  PUSH(unit);
+
+  ip = st->code + fr.instruction_pointer / 4;
+
+  if (st->does_return) {
+    SAVE_STATE();
+    return unit;
+  }
+
+  JIT_ENTER();
+  REGISTERS_ENTER();
+  DISPATCH();
+}
+
+// Superinstructions, see superinstructions.c
+
+HANDLER(op_load_local_load_local_add_int) {
+  Value a = values[bp + i1];
+  Value b = values[bp + in(1, 1)];
+
+  PUSH(MAKE_INTEGER(a + b));
+  INCREASE_IP_BY(3);
+  DISPATCH();
+}
+
+HANDLER(op_load_local_load_local_add) {
+  ASSERT_FMT(get_type(values[bp + i1]) == TYPE_INTEGER && get_type(values[bp + in(1, 1)]) == TYPE_INTEGER,
+             "Expected integers, got %s and %s", type_of(values[bp + i1]), type_of(values[bp + in(1, 1)]));
+  TAIL(op_load_local_load_local_add_int);
+}
+
+HANDLER(op_load_local_sub_const_int) {
+  Value a = values[bp + i1];
+  Value b = constants[in(1, 1)];
+
+  PUSH(MAKE_INTEGER(a - b));
+  INCREASE_IP_BY(2);
+  DISPATCH();
+}
+
+HANDLER(op_load_local_sub_const_verified) {
+  ASSERT_FMT(get_type(values[bp + i1]) == TYPE_INTEGER, "Expected integers, got %s and %s", type_of(values[bp + i1]), type_of(constants[in(1, 1)]));
+  TAIL(op_load_local_sub_const_int);
+}
+
+HANDLER(op_load_local_sub_const) {
+  ASSERT_FMT(get_type(constants[in(1, 1)]) == TYPE_INTEGER, "Expected integer constant, got %s", type_of(constants[in(1, 1)]));
+  TAIL(op_load_local_sub_const_verified);
+}
+
+HANDLER(op_load_local_return) {
+  PUSH(values[bp + i1]);
+  INCREASE_IP();
+  TAIL(op_return);
+}
+
+HANDLER(op_load_local_ijump_else_rel_cmp_constant_int) {
+  Value a = values[bp + i1];
+  Value b = constants[in(1, 3)];
+
+  uint32_t res = icompare(in(1, 2), GET_INT(a), GET_INT(b));
+  INCREASE_IP_BY(res == 0 ? 1 + in(1, 1) : 2);
+  DISPATCH();
+}
+
+HANDLER(op_load_local_ijump_else_rel_cmp_constant_verified) {
+  ASSERT(get_type(values[bp + i1]) == TYPE_INTEGER, "Expected integers");
+  TAIL(op_load_local_ijump_else_rel_cmp_constant_int);
+}
+
+HANDLER(op_load_local_ijump_else_rel_cmp_constant) {
+  ASSERT_FMT(in(1, 2) >= LessThan && in(1, 2) <= Or, "Invalid integer comparison %d", in(1, 2));
+  ASSERT_FMT(get_type(constants[in(1, 3)]) == TYPE_INTEGER, "Expected integer constant, got %s", type_of(constants[in(1, 3)]));
+  TAIL(op_load_local_ijump_else_rel_cmp_constant_verified);
+}
+
+HANDLER(op_load_local_call_global) {
+  PUSH(values[bp + i1]);
+  INCREASE_IP();
+  // The call may be a tail call, or have been quickened
+  DISPATCH();
+}
+
+HANDLER(op_load_global_list_get) {
+  Value list = values[i1];
+  uint32_t idx = GET_INT(in(1, 1));
+  ASSERT_FMT(get_type(list) == TYPE_LIST, "Invalid list type at IPC %d", PC() / 4 + 1);
+  HeapValue* l = GET_PTR(list);
+  ASSERT(idx < l->length, "Index out of bounds");
+  PUSH(list_element(l, idx));
+  INCREASE_IP_BY(2);
+  DISPATCH();
+}
+
+HANDLER(op_load_global_ijump_else_rel_cmp_constant_verified) {
+  Value a = values[i1];
+  Value b = constants[in(1, 3)];
+
+  ASSERT(get_type(a) == TYPE_INTEGER, "Expected integers");
+
+  uint32_t res = icompare(in(1, 2), GET_INT(a), GET_INT(b));
+  INCREASE_IP_BY(res == 0 ? 1 + in(1, 1) : 2);
+  DISPATCH();
+}
+
+HANDLER(op_load_global_ijump_else_rel_cmp_constant) {
+  ASSERT_FMT(in(1, 2) >= LessThan && in(1, 2) <= Or, "Invalid integer comparison %d", in(1, 2));
+  ASSERT_FMT(get_type(constants[in(1, 3)]) == TYPE_INTEGER, "Expected integer constant, got %s", type_of(constants[in(1, 3)]));
+  TAIL(op_load_global_ijump_else_rel_cmp_constant_verified);
+}
+
+HANDLER(op_load_global_add_const_store_global_verified) {
+  Value a = values[i1];
+  Value b = constants[in(1, 1)];
+
+  ASSERT_FMT(get_type(a) == TYPE_INTEGER, "Expected integers, got %s and %s", type_of(a), type_of(b));
+
+  int32_t global = in(2, 1);
+  gc_value_barrier(&st->gc, values[global]);
+  values[global] = MAKE_INTEGER(a + b);
+  INCREASE_IP_BY(3);
+  DISPATCH();
+}
+
+HANDLER(op_load_global_add_const_store_global) {
+  ASSERT_FMT(get_type(constants[in(1, 1)]) == TYPE_INTEGER, "Expected integer constant, got %s", type_of(constants[in(1, 1)]));
+  TAIL(op_load_global_add_const_store_global_verified);
+}
+
+HANDLER(op_store_global_jump_rel) {
+  gc_value_barrier(&st->gc, values[i1]);
+  values[i1] = POP();
+  INCREASE_IP_BY(1 + in(1, 1));
+  DISPATCH();
+}
+
+#define UNKNOWN op_unknown
+
+static const Handler handlers[] = {
+  op_load_local, op_store_local, op_load_constant,
+  op_load_global, op_store_global, op_return,
+  op_compare, op_and, op_or, op_load_native,
+  op_make_list, op_list_get, op_call,
+  op_jump_else_rel, op_type_of, UNKNOWN, UNKNOWN,
+  op_make_lambda, op_get_index,
+  op_special, op_jump_rel, op_slice, op_list_length,
+  op_halt, op_update, op_make_mutable, op_unmut,
+  op_add, op_sub, op_return_const, op_add_const,
+  op_sub_const, op_jump_else_rel_cmp, op_ijump_else_rel_cmp,
+  op_jump_else_rel_cmp_constant,
+  op_ijump_else_rel_cmp_constant, op_call_global,
+  op_call_local, op_make_and_store_lambda, op_mul,
+  op_mul_const, op_return_unit, op_switch,
+  op_add_int, op_sub_int, op_mul_int, op_add_const_int,
+  op_sub_const_int, op_mul_const_int,
+  op_ijump_else_rel_cmp_constant_int,
+  op_load_local_load_local_add, op_load_local_sub_const,
+  op_load_local_return, op_load_local_ijump_else_rel_cmp_constant,
+  op_load_local_call_global, op_load_global_list_get,
+  op_load_global_ijump_else_rel_cmp_constant,
+  op_load_global_add_const_store_global, op_store_global_jump_rel,
+  op_load_local_load_local_add_int, op_load_local_sub_const_int,
+  op_load_local_ijump_else_rel_cmp_constant_int,
+  op_tail_call, op_tail_call_global, op_tail_call_local };
+
+// Handlers of verified modules, where they differ
+static const Handler verified_handlers[OPCODE_COUNT] = {
+  [OP_Compare] = op_compare_verified,
+  [OP_LoadNative] = op_load_native_verified,
+  [OP_AddConst] = op_add_const_verified,
+  [OP_SubConst] = op_sub_const_verified,
+  [OP_MulConst] = op_mul_const_verified,
+  [OP_JumpElseRelCmp] = op_jump_else_rel_cmp_verified,
+  [OP_IJumpElseRelCmp] = op_ijump_else_rel_cmp_verified,
+  [OP_IJumpElseRelCmpConst] = op_ijump_else_rel_cmp_constant_verified,
+  [OP_LoadLocalSubConst] = op_load_local_sub_const_verified,
+  [OP_LoadLocalIJumpElseRelCmpConst] = op_load_local_ijump_else_rel_cmp_constant_verified,
+  [OP_LoadGlobalIJumpElseRelCmpConst] = op_load_global_ijump_else_rel_cmp_constant_verified,
+  [OP_LoadGlobalAddConstStoreGlobal] = op_load_global_add_const_store_global_verified };
+
+#undef module
+#undef values
+#undef constants
+
+Value run_interpreter_tail(Deserialized *module, int32_t ipc, bool does_return, int32_t current_callstack) {
+  // Translated the first time the module runs, shared with threads it spawns
+  if (module->tail_code == NULL) {
+    int32_t* bytecode = module->instrs;
+    TailInstruction* code = gc_malloc(&module->gc, module->instr_count * sizeof(TailInstruction));
+    for (int32_t i = 0; i < module->instr_count; i++) {
+      int32_t opcode = bytecode[i * 4];
+      bool known = opcode >= 0 && opcode < (int32_t) (sizeof(handlers) / sizeof(*handlers));
+      code[i].handler = known ? handlers[opcode] : UNKNOWN;
+      if (known && module->verified && verified_handlers[opcode] != NULL) code[i].handler = verified_handlers[opcode];
+      memcpy(code[i].operands, &bytecode[i * 4 + 1], sizeof(code[i].operands));
+    }
+    module->tail_code = code;
+  }
+  if (module->call_caches == NULL) module->call_caches = gc_calloc(&module->gc, module->instr_count, sizeof(CallCache));
+
+#if JIT
+  if (module->jit == NULL) module->jit = jit_new(module);
+#endif
+
+  TailState st = {
+    .module = module,
+    .code = module->tail_code,
+    .values = module->stack->values,
+    .constants = module->constants,
+    .gc = module->gc,
+    .does_return = does_return,
+    .current_callstack = current_callstack,
+  };
+
+  const TailInstruction* ip = st.code + ipc / 4;
+  return ip->handler(&st, ip, st.values + module->stack->stack_pointer, module->base_pointer);
+}
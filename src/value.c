@@ -7,15 +7,14 @@ char* constructor_name(Value v) {
   ASSERT(get_type(v) == TYPE_LIST, "Cannot get constructor name of non-list value");
 
   HeapValue* arr = GET_PTR(v);
-  Value* data = arr->as_ptr;
 
   ASSERT(arr->length > 0, "Cannot get constructor name of empty value");
-  ASSERT(get_type(data[0]) == TYPE_SPECIAL,
+  ASSERT(get_type(list_element(arr, 0)) == TYPE_SPECIAL,
          "Cannot get constructor name of non-type value");
-  ASSERT(get_type(data[1]) == TYPE_STRING,
+  ASSERT(get_type(list_element(arr, 1)) == TYPE_STRING,
          "Constructor name must be a string");
 
-  return GET_STRING(data[1]);
+  return GET_STRING(list_element(arr, 1));
 }
 
 Value equal(Value x, Value y) {
@@ -28,7 +27,7 @@ Value equal(Value x, Value y) {
     case TYPE_FLOAT:
       return MAKE_INTEGER(x == y);
     case TYPE_STRING:
-      return MAKE_INTEGER(strcmp(GET_STRING(x), GET_STRING(y)) == 0);
+      return MAKE_INTEGER(string_equal(GET_PTR(x), GET_PTR(y)));
     case TYPE_LIST: {
       HeapValue* x_heap = GET_PTR(x);
       HeapValue* y_heap = GET_PTR(y);
@@ -36,11 +35,8 @@ Value equal(Value x, Value y) {
         return MAKE_INTEGER(0);
       }
 
-      Value* x_values = x_heap->as_ptr;
-      Value* y_values = y_heap->as_ptr;
-
       for (uint32_t i = 0; i < x_heap->length; i++) {
-        if ((int32_t) !equal(x_values[i], y_values[i])) {
+        if ((int32_t) !equal(list_element(x_heap, i), list_element(y_heap, i))) {
           return MAKE_INTEGER(0);
         }
       }
@@ -82,7 +78,7 @@ void native_print(Value value) {
         break;
       }
       for (uint32_t i = 0; i < list->length; i++) {
-        native_print(list->as_ptr[i]);
+        native_print(list_element(list, i));
         if (i < list->length - 1) {
           printf(", ");
         }
@@ -0,0 +1,271 @@
+#include <bytecode.h>
+#include <core/debug.h>
+#include <interpreter.h>
+#include <switches.h>
+#include <verifier.h>
+
+// The bytecode is a sequence of regions: the top level, and the body of each
+// function, which follows the MakeLambda or MakeAndStoreLambda creating it
+// and may itself contain functions. Every region is checked on its own:
+// jumps stay in their region, locals are those of the function, and the
+// stack depth before each reachable instruction is the same on every path
+// leading to it. A native function pushed by LoadNative is followed on the
+// stack by the two indices resolve_native pops, which is tracked to know
+// what a Call consumes.
+
+typedef struct {
+  Deserialized *module;
+  int32_t *region;    // first instruction of the region of each instruction
+  int32_t *depths;    // stack depth before each instruction, -1 if unreached
+  bool *natives;      // whether a native function is on top of the stack
+  int32_t *worklist;
+} Verifier;
+
+#define FAIL(i, ...)                                      \
+  do {                                                    \
+    (void) (i);                                           \
+    DEBUG_PRINTLN("Unverified bytecode at IPC %d", (i));  \
+    DEBUG_PRINTLN(__VA_ARGS__);                           \
+    return false;                                         \
+  } while (0)
+
+typedef struct {
+  int32_t first, end;
+  int32_t local_space;  // -1 at the top level, which has no locals
+} Region;
+
+static int32_t *instr(Verifier *v, int32_t i) { return &v->module->instrs[i * 4]; }
+
+static bool is_constant(Verifier *v, int32_t c) { return c >= 0 && c < v->module->constant_count; }
+
+static bool is_constant_of(Verifier *v, int32_t c, ValueType type) {
+  return is_constant(v, c) && get_type(v->module->constants[c]) == type;
+}
+
+static bool is_global(int32_t g) { return g >= 0 && g < GLOBALS_SIZE; }
+
+static bool is_local(Region r, int32_t l) { return r.local_space >= 0 && l >= -r.local_space && l < 0; }
+
+static bool in_region(Verifier *v, Region r, int32_t i) {
+  return i >= r.first && i < r.end && v->region[i] == r.first;
+}
+
+// Length of the function body created at `i`, 0 if there is none
+static int32_t body_length(Verifier *v, int32_t i) {
+  int32_t *in = instr(v, i);
+  if (in[0] == OP_MakeLambda) return in[1];
+  if (in[0] == OP_MakeAndStoreLambda) return in[2];
+  return 0;
+}
+
+// Checks the operands of instruction `i` that do not depend on the stack
+static bool verify_operands(Verifier *v, Region r, int32_t i) {
+  int32_t *in = instr(v, i);
+  int32_t i1 = in[1], i2 = in[2], i3 = in[3];
+
+  switch (in[0]) {
+    case OP_LoadLocal: case OP_StoreLocal:
+      if (!is_local(r, i1)) FAIL(i, "Invalid local %d", i1);
+      return true;
+    case OP_CallLocal:
+      if (!is_local(r, i1)) FAIL(i, "Invalid local %d", i1);
+      if (i2 < 0) FAIL(i, "Invalid argument count %d", i2);
+      return true;
+    case OP_LoadGlobal: case OP_StoreGlobal:
+      if (!is_global(i1)) FAIL(i, "Invalid global %d", i1);
+      return true;
+    case OP_CallGlobal:
+      if (!is_global(i1)) FAIL(i, "Invalid global %d", i1);
+      if (i2 < 0) FAIL(i, "Invalid argument count %d", i2);
+      return true;
+    case OP_LoadConstant:
+      if (!is_constant(v, i1)) FAIL(i, "Invalid constant %d", i1);
+      return true;
+    case OP_ReturnConst:
+      if (r.local_space < 0) FAIL(i, "Return outside of a function");
+      if (!is_constant(v, i1)) FAIL(i, "Invalid constant %d", i1);
+      return true;
+    case OP_AddConst: case OP_SubConst: case OP_MulConst:
+      if (!is_constant_of(v, i1, TYPE_INTEGER)) FAIL(i, "Invalid integer constant %d", i1);
+      return true;
+    case OP_LoadNative:
+      if (!is_constant_of(v, i1, TYPE_STRING)) FAIL(i, "Invalid native function name %d", i1);
+      return true;
+    case OP_Compare:
+      if (!valid_comparison(i1)) FAIL(i, "Invalid comparison %d", i1);
+      return true;
+    case OP_JumpElseRelCmp:
+      if (!valid_comparison(i2)) FAIL(i, "Invalid comparison %d", i2);
+      return true;
+    case OP_IJumpElseRelCmp:
+      // Indexed like comparison_table, only equality, and and or are defined
+      if (i1 != 2 && i1 != 5 && i1 != 6) FAIL(i, "Invalid integer comparison %d", i1);
+      return true;
+    case OP_JumpElseRelCmpConst:
+      if (!is_constant(v, i3)) FAIL(i, "Invalid constant %d", i3);
+      return true;
+    case OP_IJumpElseRelCmpConst:
+      if (i2 < LessThan || i2 > Or) FAIL(i, "Invalid integer comparison %d", i2);
+      if (!is_constant_of(v, i3, TYPE_INTEGER)) FAIL(i, "Invalid integer constant %d", i3);
+      return true;
+    case OP_Call:
+      if (i1 < 0) FAIL(i, "Invalid argument count %d", i1);
+      return true;
+    case OP_Switch:
+      if (i3 < 0 || i3 >= v->module->switch_count) FAIL(i, "Invalid switch table %d", i3);
+      return true;
+    case OP_MakeList: case OP_Slice:
+      if (i1 < 0) FAIL(i, "Invalid length %d", i1);
+      return true;
+    case OP_MakeAndStoreLambda:
+      if (!is_global(i1)) FAIL(i, "Invalid global %d", i1);
+      return true;
+    case OP_Return: case OP_ReturnUnit:
+      if (r.local_space < 0) FAIL(i, "Return outside of a function");
+      return true;
+    case OP_And: case OP_Or: case OP_ListGet: case OP_JumpElseRel: case OP_TypeOf:
+    case OP_MakeLambda: case OP_GetIndex: case OP_Special: case OP_JumpRel:
+    case OP_ListLength: case OP_Halt: case OP_Update: case OP_MakeMutable:
+    case OP_UnMut: case OP_Add: case OP_Sub: case OP_Mul:
+      return true;
+    default:
+      FAIL(i, "Invalid opcode %d", in[0]);
+  }
+}
+
+Effect instruction_effect(Deserialized *module, int32_t i, bool native) {
+  int32_t *in = &module->instrs[i * 4];
+  int32_t i1 = in[1], i2 = in[2];
+  Effect e = { 0, 0, i + 1, 0, false, false, NULL, 0 };
+
+  switch (in[0]) {
+    case OP_LoadLocal: case OP_LoadConstant: case OP_LoadGlobal: case OP_Special:
+      e.pushes = 1; break;
+    case OP_StoreLocal: case OP_StoreGlobal:
+      e.pops = 1; break;
+    case OP_Return:
+      e.pops = 1; e.next = -1; break;
+    case OP_ReturnConst: case OP_ReturnUnit: case OP_Halt:
+      e.next = -1; break;
+    case OP_Compare: case OP_And: case OP_Or: case OP_GetIndex:
+    case OP_Add: case OP_Sub: case OP_Mul:
+      e.pops = 2; e.pushes = 1; break;
+    case OP_LoadNative:
+      e.pushes = 3; e.native = true; break;
+    case OP_MakeList:
+      e.pops = i1; e.pushes = 1; break;
+    case OP_ListGet: case OP_TypeOf: case OP_Slice: case OP_ListLength:
+    case OP_MakeMutable: case OP_UnMut:
+    case OP_AddConst: case OP_SubConst: case OP_MulConst:
+      e.pops = 1; e.pushes = 1; break;
+    case OP_Call:
+      // The indices of a native function are popped with it
+      e.pops = 1 + (native ? 2 : 0) + i1; e.pushes = 1; break;
+    case OP_CallGlobal: case OP_CallLocal:
+      e.pops = i2; e.pushes = 1; break;
+    case OP_Update:
+      e.pops = 2; break;
+    case OP_MakeLambda:
+      e.pushes = 1; e.next = i + 1 + i1; break;
+    case OP_MakeAndStoreLambda:
+      e.next = i + 1 + i2; break;
+    case OP_JumpRel:
+      e.next = -1; e.jumps = true; e.target = i + i1; break;
+    case OP_JumpElseRel: case OP_JumpElseRelCmpConst: case OP_IJumpElseRelCmpConst:
+      e.pops = 1; e.jumps = true; e.target = i + i1; break;
+    case OP_JumpElseRelCmp:
+      e.pops = 2; e.jumps = true; e.target = i + i1; break;
+    case OP_IJumpElseRelCmp:
+      e.pops = 2; e.jumps = true; e.target = i + i2; break;
+    case OP_Switch: {
+      Switch *s = module->switches[in[3]];
+      e.pops = 1; e.next = -1; e.jumps = true; e.target = i + i2;
+      e.arms = s->offsets; e.arm_count = s->count;
+      break;
+    }
+  }
+  return e;
+}
+
+static bool verify_region(Verifier *v, Region r);
+
+// Assigns instructions to `r` and verifies the functions it contains
+static bool verify_structure(Verifier *v, Region r) {
+  for (int32_t i = r.first; i < r.end; i++) {
+    v->region[i] = r.first;
+    if (!verify_operands(v, r, i)) return false;
+
+    int32_t *in = instr(v, i);
+    if (in[0] != OP_MakeLambda && in[0] != OP_MakeAndStoreLambda) continue;
+
+    int32_t length = body_length(v, i);
+    int32_t local_space = in[0] == OP_MakeLambda ? in[2] : in[3];
+    if (length < 0 || i + length >= r.end) FAIL(i, "Function body out of bounds");
+    if (local_space < 0 || local_space > INT16_MAX) FAIL(i, "Invalid local space %d", local_space);
+    // Functions store their address in 16 bits
+    if ((i + 1) * 4 > INT16_MAX) FAIL(i, "Function address out of range");
+
+    Region body = { i + 1, i + 1 + length, local_space };
+    if (!verify_region(v, body)) return false;
+    i += length;
+  }
+  return true;
+}
+
+static bool reach(Verifier *v, Region r, int32_t from, int32_t i, int32_t depth, bool native, int32_t *count) {
+  if (!in_region(v, r, i)) FAIL(from, "Control leaves its function to IPC %d", i * 4);
+
+  if (v->depths[i] < 0) {
+    v->depths[i] = depth;
+    v->natives[i] = native;
+    v->worklist[(*count)++] = i;
+  } else if (v->depths[i] != depth || v->natives[i] != native) {
+    FAIL(i, "Inconsistent stack depth, %d and %d", v->depths[i], depth);
+  }
+  return true;
+}
+
+static bool verify_region(Verifier *v, Region r) {
+  if (r.first == r.end) return true;
+  if (!verify_structure(v, r)) return false;
+
+  int32_t count = 0;
+  if (!reach(v, r, r.first, r.first, 0, false, &count)) return false;
+
+  while (count > 0) {
+    int32_t i = v->worklist[--count];
+    int32_t depth = v->depths[i];
+    Effect e = instruction_effect(v->module, i, v->natives[i]);
+
+    if (e.pops > depth) FAIL(i, "Stack underflow, %d values for %d", depth, e.pops);
+    depth += e.pushes - e.pops;
+
+    if (e.next >= 0 && !reach(v, r, i, e.next, depth, e.native, &count)) return false;
+    if (e.jumps && !reach(v, r, i, e.target, depth, false, &count)) return false;
+    for (int32_t k = 0; k < e.arm_count; k++) {
+      if (!reach(v, r, i, i + e.arms[k], depth, false, &count)) return false;
+    }
+  }
+  return true;
+}
+
+bool verify_module(Deserialized *module) {
+  int32_t n = module->instr_count;
+  Verifier v = {
+    .module = module,
+    .region = malloc(n * sizeof(int32_t)),
+    .depths = malloc(n * sizeof(int32_t)),
+    .natives = malloc(n * sizeof(bool)),
+    .worklist = malloc(n * sizeof(int32_t)),
+  };
+  for (int32_t i = 0; i < n; i++) v.depths[i] = -1;
+
+  Region top = { 0, n, -1 };
+  bool verified = verify_region(&v, top);
+
+  free(v.region);
+  free(v.depths);
+  free(v.natives);
+  free(v.worklist);
+  return verified;
+}
@@ -0,0 +1,135 @@
+// Regression test: minor collections scan the stack up to its top, so the
+// locals of a new frame must not keep young pointers left by an earlier one.
+//
+// stale() leaves a pointer to a young list in its local and returns. After a
+// minor collection, the nursery is refilled so that a live list covers that
+// address. churn() then reuses the slot as its own local, unwritten, and
+// allocates past the next minor collection with the live list on its
+// operand stack. Scanning the slot would promote a block read from inside
+// the live list, and write a forwarding pointer into it.
+//
+// Usage: plume-stale-locals-test
+
+#include <bytecode.h>
+#include <inference.h>
+#include <interpreter.h>
+#include <module.h>
+#include <superinstructions.h>
+#include <verifier.h>
+#include <stdio.h>
+
+#define STALE 0
+#define CHURN 1
+#define JUNK 2
+#define I 3
+#define LIVE 4
+
+// Constants of the program
+enum { C_ZERO, C_ONE, C_ITERATIONS };
+
+static const int32_t program[][4] = {
+  // stale(), no argument and two locals, the second of which holds the
+  // second list it makes. The first one is where its result goes.
+  /*  0 */ { OP_MakeAndStoreLambda, STALE, 8, 2 },
+  /*  1 */ { OP_LoadConstant, C_ONE, 0, 0 },
+  /*  2 */ { OP_MakeList, 1, 0, 0 },
+  /*  3 */ { OP_StoreGlobal, JUNK, 0, 0 },
+  /*  4 */ { OP_LoadConstant, C_ONE, 0, 0 },
+  /*  5 */ { OP_MakeList, 1, 0, 0 },
+  /*  6 */ { OP_StoreLocal, -1, 0, 0 },
+  /*  7 */ { OP_LoadConstant, C_ONE, 0, 0 },
+  /*  8 */ { OP_Return, 0, 0, 0 },
+
+  // churn(), no argument and two locals it never writes. It keeps the live
+  // list on its operand stack, above the locals, while it allocates.
+  /*  9 */ { OP_MakeAndStoreLambda, CHURN, 17, 2 },
+  /* 10 */ { OP_LoadGlobal, LIVE, 0, 0 },
+  /* 11 */ { OP_LoadConstant, C_ZERO, 0, 0 },
+  /* 12 */ { OP_StoreGlobal, LIVE, 0, 0 },
+  /* 13 */ { OP_LoadConstant, C_ZERO, 0, 0 },
+  /* 14 */ { OP_StoreGlobal, I, 0, 0 },
+  /* 15 */ { OP_LoadGlobal, I, 0, 0 },
+  /* 16 */ { OP_IJumpElseRelCmpConst, 8, LessThan, C_ITERATIONS },
+  /* 17 */ { OP_LoadConstant, C_ONE, 0, 0 },
+  /* 18 */ { OP_MakeList, 1, 0, 0 },
+  /* 19 */ { OP_StoreGlobal, JUNK, 0, 0 },
+  /* 20 */ { OP_LoadGlobal, I, 0, 0 },
+  /* 21 */ { OP_AddConst, C_ONE, 0, 0 },
+  /* 22 */ { OP_StoreGlobal, I, 0, 0 },
+  /* 23 */ { OP_JumpRel, -8, 0, 0 },
+  /* 24 */ { OP_StoreGlobal, LIVE, 0, 0 },
+  /* 25 */ { OP_LoadConstant, C_ONE, 0, 0 },
+  /* 26 */ { OP_Return, 0, 0, 0 },
+
+  /* 27 */ { OP_CallGlobal, STALE, 0, 0 },
+  /* 28 */ { OP_Halt, 0, 0, 0 },
+  /* 29 */ { OP_CallGlobal, CHURN, 0, 0 },
+  /* 30 */ { OP_Halt, 0, 0, 0 },
+};
+
+#define INSTR_COUNT ((int32_t) (sizeof(program) / sizeof(*program)))
+
+static void run(Deserialized* module, int32_t ipc) {
+  halt = 0;
+  module->callstack = 0;
+  module->base_pointer = 0;
+  module->stack->stack_pointer = BASE_POINTER;
+  run_interpreter(module, ipc, false, 0);
+}
+
+int main(int argc, char** argv) {
+  (void) argv;
+  gc_start(&gc, &argc);
+  gc_set_tracer(&gc, gc_trace_heap_value);
+
+  // Enough lists to fill the nursery more than once
+  Value constants[] = { MAKE_INTEGER(0), MAKE_INTEGER(1), MAKE_INTEGER(4 * GC_NURSERY_SIZE / 32) };
+
+  int32_t* instrs = gc_malloc(&gc, sizeof(program));
+  memcpy(instrs, program, sizeof(program));
+
+  Deserialized module = { 0 };
+  module.instr_count = INSTR_COUNT;
+  module.instrs = instrs;
+  module.constant_count = sizeof(constants) / sizeof(*constants);
+  module.constants = constants;
+  module.verified = verify_module(&module);
+  module.gc = gc;
+  if (module.verified) specialize_integers(&module);
+  fuse_superinstructions(instrs, INSTR_COUNT);
+  module.stack = stack_new(gc);
+  module.call_function = call_function;
+  module.call_threaded = call_threaded;
+  gc_add_root(&gc, module_mark_roots, &module);
+  gc_add_root(&gc, nursery_mark_roots, NULL);
+  gc_nursery_set_scavenger(&gc, module_scavenge, &module);
+
+  // The lists of stale() start the nursery, the second one 32 bytes in
+  gc_minor(&gc);
+  run(&module, 0);
+  module.stack->stack_pointer = BASE_POINTER;
+  gc_minor(&gc);
+
+  // Three elements, so that the second list of stale() points at the last
+  // one, and reads the second as its header
+  Value elements[] = { MAKE_INTEGER(8), MAKE_INTEGER(8), MAKE_INTEGER(8) };
+  module.stack->values[LIVE] = MAKE_LIST(gc, elements, 3);
+
+  run(&module, 29 * 4);
+
+  HeapValue* live = GET_PTR(module.stack->values[LIVE]);
+  int failed = !module.verified || live->length != 3 || live->flags != 0;
+  for (uint32_t i = 0; i < 3 && !failed; i++) failed = list_element(live, i) != elements[i];
+
+  if (failed) {
+    fprintf(stderr, "A stale local was scavenged: length %u, flags %u, %s module\n", live->length, live->flags,
+            module.verified ? "verified" : "unverified");
+    return 1;
+  }
+  printf("ok\n");
+
+  gc_remove_root(&gc, module_mark_roots, &module);
+  gc_remove_root(&gc, nursery_mark_roots, NULL);
+  gc_stop(&gc);
+  return 0;
+}
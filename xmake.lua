@@ -6,6 +6,34 @@ end
 
 set_warnings("allextra")
 
+option("tail-call-interpreter")
+  set_default(false)
+  set_showmenu(true)
+  set_description("Run bytecode on the tail-calling interpreter instead of the computed-goto loop")
+  add_defines("TAIL_CALL_INTERPRETER=1")
+option_end()
+
+option("register-tier")
+  set_default(false)
+  set_showmenu(true)
+  set_description("Translate verified functions to register code at load and run them on it")
+  add_defines("REGISTER_TIER=1")
+option_end()
+
+option("jit")
+  set_default(false)
+  set_showmenu(true)
+  set_description("Compile hot functions to x86-64 machine code, on Linux only")
+  add_defines("JIT=1")
+option_end()
+
+option("packed-int-lists")
+  set_default(false)
+  set_showmenu(true)
+  set_description("Store lists of integers built by MakeList as int32_t, which GET_LIST cannot read")
+  add_defines("PACKED_INT_LISTS=1")
+option_end()
+
 target("plume-vm")
   add_rules("mode.release")
   add_files("src/**.c")
@@ -13,6 +41,10 @@ target("plume-vm")
   set_kind("binary") 
   set_targetdir("bin")
   set_optimize("fastest")
+  add_options("tail-call-interpreter", "register-tier", "jit", "packed-int-lists")
+  if not is_plat("windows") then
+    add_syslinks("pthread")
+  end
 
 target("plume-vm-test")
   add_rules("mode.debug", "mode.profile")
@@ -21,6 +53,47 @@ target("plume-vm-test")
   set_targetdir("bin")
   set_kind("binary")
   set_symbols("debug")
+  add_options("tail-call-interpreter", "register-tier", "jit", "packed-int-lists")
   add_cxflags("-pg")
   add_ldflags("-pg")
   set_optimize("fastest")
+  if not is_plat("windows") then
+    add_syslinks("pthread")
+  end
+
+target("plume-gc-bench")
+  set_default(false)
+  add_rules("mode.release")
+  add_files("bench/gc_mark.c")
+  add_includedirs("include")
+  set_kind("binary")
+  set_targetdir("bin")
+  set_optimize("fastest")
+  if not is_plat("windows") then
+    add_syslinks("pthread")
+  end
+
+target("plume-dispatch-bench")
+  set_default(false)
+  add_rules("mode.release")
+  add_files("src/**.c|main.c", "bench/dispatch.c")
+  add_includedirs("include")
+  add_options("register-tier", "jit", "packed-int-lists")
+  set_kind("binary")
+  set_targetdir("bin")
+  set_optimize("fastest")
+  if not is_plat("windows") then
+    add_syslinks("pthread")
+  end
+
+target("plume-stale-locals-test")
+  set_default(false)
+  add_rules("mode.debug")
+  add_files("src/**.c|main.c", "test/stale_locals.c")
+  add_includedirs("include")
+  add_options("tail-call-interpreter")
+  set_kind("binary")
+  set_targetdir("bin")
+  if not is_plat("windows") then
+    add_syslinks("pthread")
+  end